@@ -1,6 +1,6 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
+ *           aarch64, Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -9,7 +9,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
 
@@ -21,9 +25,9 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * Pentium and x86-64 versions of start_counter() and get_counter()
  *******************************************************/
 
 
@@ -32,15 +36,43 @@
 static unsigned cyc_hi = 0;
 static unsigned cyc_lo = 0;
 
+/* 1 if the processor has rdtscp, 0 if not, -1 until we know */
+static int has_rdtscp = -1;
+
+static int use_rdtscp()
+{
+    unsigned a, b, c, d;
+
+    if (has_rdtscp < 0)
+	has_rdtscp = __get_cpuid(0x80000001, &a, &b, &c, &d) && (d & (1 << 27));
+    return has_rdtscp;
+}
 
 /* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
+   Implementation requires assembly code to use the rdtsc instruction,
+   or rdtscp where there is one, which waits for the instructions
+   before it to finish. */
 void access_counter(unsigned *hi, unsigned *lo)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-	: "=r" (*hi), "=r" (*lo)                /* and move results to */
-	: /* No input */                        /* the two outputs */
-	: "%edx", "%eax");
+    if (use_rdtscp())
+	asm volatile("rdtscp" : "=d" (*hi), "=a" (*lo) : : "%ecx");
+    else
+	asm volatile("rdtsc" : "=d" (*hi), "=a" (*lo));
+}
+
+/* Return the counter's name, and 1 if it runs at a constant rate
+   whatever the clock speed and sleep state of the processor, which
+   cpuid reports as an invariant TSC */
+char *counter_name()
+{
+    return use_rdtscp() ? "rdtscp" : "rdtsc";
+}
+
+int counter_invariant()
+{
+    unsigned a, b, c, d;
+
+    return __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1 << 8));
 }
 
 /* Record the current value of the cycle counter. */
@@ -71,6 +103,45 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+#elif defined(__aarch64__)
+
+/****************************************************
+ * aarch64 versions of start_counter() and get_counter()
+ ***************************************************/
+
+/* The virtual count of the generic timer. It ticks at a constant rate,
+   often well below the clock rate of the processor, which the isb keeps
+   from being read before the instructions ahead of it are done. */
+static unsigned long long cyc = 0;
+
+static unsigned long long access_counter()
+{
+    unsigned long long t;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (t) : : "memory");
+    return t;
+}
+
+void start_counter()
+{
+    cyc = access_counter();
+}
+
+double get_counter()
+{
+    return (double)(access_counter() - cyc);
+}
+
+char *counter_name()
+{
+    return "cntvct_el0";
+}
+
+int counter_invariant()
+{
+    return 1;
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -133,6 +204,16 @@ double get_counter()
     return result;
 }
 
+char *counter_name()
+{
+    return "rpcc";
+}
+
+int counter_invariant()
+{
+    return 0;
+}
+
 #else
 
 /****************************************************************
@@ -158,6 +239,16 @@ double get_counter()
     printf("Please choose another timing package in config.h.\n");
     exit(1);
 }
+
+char *counter_name()
+{
+    return "none";
+}
+
+int counter_invariant()
+{
+    return 0;
+}
 #endif
 
 
@@ -179,18 +270,41 @@ double ovhd()
     return result;
 }
 
+/* Return CLOCK_MONOTONIC time in seconds */
+static double monotonic()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Count the cycles that elapse over secs seconds of CLOCK_MONOTONIC,
+   spinning rather than sleeping so the processor stays busy, and
+   return their rate in MHz */
+static double calibrate_mhz(double secs)
+{
+    double start, end;
+
+    start = monotonic();
+    start_counter();
+    while ((end = monotonic()) - start < secs)
+	;
+    return get_counter() / (1e6*(end - start));
+}
+
 /* $begin mhz */
 /* Estimate the clock rate by measuring the cycles that elapse */ 
-/* while sleeping for sleeptime seconds */
+/* over sleeptime seconds, or 1/20 s if it is 0 */
 double mhz_full(int verbose, int sleeptime)
 {
     double rate;
 
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
-    if (verbose) 
-	printf("Processor clock rate ~= %.1f MHz\n", rate);
+    rate = calibrate_mhz(sleeptime ? sleeptime : 0.05);
+    if (verbose) {
+	printf("Processor clock rate ~= %.1f MHz, by %s", rate, counter_name());
+	printf(counter_invariant() ? " (invariant)\n" : " (may vary with the clock speed)\n");
+    }
     return rate;
 }
 /* $end mhz */
@@ -198,7 +312,7 @@ double mhz_full(int verbose, int sleeptime)
 /* Version using a default sleeptime */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    return mhz_full(verbose, 0);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -6,10 +6,16 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Name of the counter, and whether it keeps a constant rate
+   (an invariant TSC on x86) */
+char *counter_name();
+int counter_invariant();
+
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Determine clock rate of processor against CLOCK_MONOTONIC
+   (over a default 1/20 s) */
 double mhz(int verbose);
 
 /* Determine clock rate of processor, having more control over accuracy */
@@ -13,7 +13,7 @@
  * default tracefiles. You can override it at runtime with the -t flag.
  */
 //#define TRACEDIR "/afs/cs/project/ics2/im/labs/malloclab/traces/"
-#define TRACEDIR "./traces"
+#define TRACEDIR "./traces/"
 
 /*
  * This is the list of default tracefiles in TRACEDIR that the driver
@@ -59,14 +59,23 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Default maximum heap size in bytes. memlib only reserves this much
+ * address space; mdriver -H overrides it at runtime.
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Largest heap -H may ask for: mm.c keeps block sizes and free-list
+ * links in 32-bit words, so no block may reach 4 GB
+ */
+#define MAX_HEAP_LIMIT (4ULL<<30)  /* 4 GB */
+
 /*****************************************************************************
- * Set exactly one of these USE_xxx constants to "1" to select a timing method
+ * Set at most one of these USE_xxx constants to "1" to select the default
+ * timing method; with none set, clock_gettime(CLOCK_MONOTONIC_RAW) is used.
+ * mdriver -c picks another at run time.
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86, aarch64 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 1   /* gettimeofday (any Unix box) */
 
@@ -123,6 +123,24 @@ static void clear()
     sink = x;
 }
 
+/*
+ * fcyc_sample - Count the cycles of one run of function f, clearing the
+ *     cache first and compensating for clock ticks if set to
+ */
+double fcyc_sample(test_funct f, void *argp)
+{
+    if (clear_cache)
+	clear();
+    if (compensate) {
+	start_comp_counter();
+	f(argp);
+	return get_comp_counter();
+    }
+    start_counter();
+    f(argp);
+    return get_counter();
+}
+
 /*
  * fcyc - Use K-best scheme to estimate the running time of function f
  */
@@ -130,27 +148,9 @@ double fcyc(test_funct f, void *argp)
 {
     double result;
     init_sampler();
-    if (compensate) {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_comp_counter();
-	    f(argp);
-	    cyc = get_comp_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
-    } else {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_counter();
-	    f(argp);
-	    cyc = get_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
-    }
+    do {
+	add_sample(fcyc_sample(f, argp));
+    } while (!has_converged() && samplecount < maxsamples);
 #ifdef DEBUG
     {
 	int i;
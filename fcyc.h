@@ -13,6 +13,10 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Count the cycles of a single run of test function f, with the
+   cache clearing and compensation set below */
+double fcyc_sample(test_funct f, void* argp);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -2,41 +2,189 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
+/* The timer config.h picks, used unless init_fsecs is given another */
+#if USE_FCYC
+#define DEFAULT_TIMER FSECS_FCYC
+#elif USE_ITIMER
+#define DEFAULT_TIMER FSECS_ITIMER
+#elif USE_GETTOD
+#define DEFAULT_TIMER FSECS_GETTOD
+#else
+#define DEFAULT_TIMER FSECS_MONOTONIC
+#endif
+
+/* How fsecs samples a function */
+#define WARMUP_RUNS      2 /* untimed runs first, to warm the caches */
+#define MIN_SAMPLES     11 /* timed samples at least... */
+#define MAX_SAMPLES   1001 /* ... and at most */
+#define MIN_SECS      0.02 /* go on sampling until they take this long */
+#define MIN_STEPS      100 /* timer steps a sample lasts at least */
+#define MAX_CALLS  (1<<16) /* runs a sample may take to last them */
+
 static double Mhz;  /* estimated CPU clock frequency */
+static int timer;   /* FSECS_FCYC, ... */
+static double resolution; /* measured resolution of timer in seconds */
+
+static char *timer_names[FSECS_TIMERS] = {
+    "fcyc", "itimer", "gettod", "monotonic"
+};
+static char *timer_descs[FSECS_TIMERS] = {
+    "a cycle counter",
+    "the interval timer",
+    "gettimeofday()",
+    "clock_gettime(CLOCK_MONOTONIC_RAW)"
+};
 
 extern int verbose; /* -v option in mdriver.c */
 
 /*
- * init_fsecs - initialize the timing package
+ * fsecs_timer - the FSECS_ timer called name, or -1 if there is none
+ */
+int fsecs_timer(char *name)
+{
+    int i;
+
+    for (i = 0; i < FSECS_TIMERS; i++)
+	if (strcmp(name, timer_names[i]) == 0)
+	    return i;
+    return -1;
+}
+
+/*
+ * init_fsecs - initialize the timing package to measure with which,
+ *     one of the FSECS_ timers, or the one config.h picks if it is -1
  */
-void init_fsecs(void)
+void init_fsecs(int which)
 {
     Mhz = 0; /* keep gcc -Wall happy */
+    timer = (which < 0) ? DEFAULT_TIMER : which;
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
     if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
-#endif
+	printf("Measuring performance with %s.\n", timer_descs[timer]);
+    switch (timer) {
+    case FSECS_FCYC:
+	if (strcmp(counter_name(), "none") == 0) {
+	    printf("ERROR: clock.c has no cycle counter for this platform\n");
+	    exit(1);
+	}
+
+	/* set key parameters for the fcyc package */
+	set_fcyc_maxsamples(20); 
+	set_fcyc_clear_cache(1);
+	set_fcyc_compensate(1);
+	set_fcyc_epsilon(0.01);
+	set_fcyc_k(3);
+	Mhz = mhz(verbose > 0);
+	if (!counter_invariant())
+	    printf("Warning: the %s counter does not keep a constant rate.\n",
+		   counter_name());
+	resolution = 1/(Mhz*1e6);
+	break;
+    case FSECS_ITIMER:
+	resolution = ftimer_itimer_resolution();
+	break;
+    case FSECS_GETTOD:
+	resolution = ftimer_gettod_resolution();
+	break;
+    default:
+	resolution = ftimer_monotonic_resolution();
+	break;
+    }
+}
+
+/*
+ * fsecs_name - description of the timer fsecs measures with
+ */
+char *fsecs_name(void)
+{
+    return timer_descs[timer];
+}
+
+/*
+ * fsecs_resolution - the smallest step of that timer, in seconds
+ */
+double fsecs_resolution(void)
+{
+    return resolution;
+}
+
+/*
+ * sample - the running time of f (in seconds), averaged over calls runs
+ */
+static double sample(fsecs_test_funct f, void *argp, int calls)
+{
+    switch (timer) {
+    case FSECS_FCYC:
+	return fcyc_sample(f, argp)/(Mhz*1e6);
+    case FSECS_ITIMER:
+	return ftimer_itimer(f, argp, calls);
+    case FSECS_GETTOD:
+	return ftimer_gettod(f, argp, calls);
+    default:
+	return ftimer_monotonic(f, argp, calls);
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * fsecs_full - Return the running time of a function f (in seconds),
+ *     the median of samples of it after WARMUP_RUNS untimed runs. A
+ *     sample with a timer coarser than the cycle counter averages as
+ *     many runs as it takes to last MIN_STEPS steps of the timer, and
+ *     samples are taken until there are MIN_SAMPLES and they have run
+ *     MIN_SECS. If stats is not NULL, it gets their spread: the median
+ *     absolute deviation, and the 95% confidence interval of the median
+ *     between the order statistics n/2 -+ 1.96 sqrt(n)/2
+ */
+double fsecs_full(fsecs_test_funct f, void *argp, fsecs_stats_t *stats)
+{
+    static double samples[MAX_SAMPLES];
+    double median, total = 0;
+    int i, n, calls = 1;
+
+    for (i = 0; i < WARMUP_RUNS; i++)
+	f(argp);
+    if (timer != FSECS_FCYC)
+	while (calls < MAX_CALLS &&
+	       sample(f, argp, calls) * calls < MIN_STEPS * resolution)
+	    calls *= 2;
+
+    for (n = 0; n < MAX_SAMPLES && (n < MIN_SAMPLES || total < MIN_SECS); n++) {
+	samples[n] = sample(f, argp, calls);
+	total += samples[n] * calls;
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    median = (samples[(n-1)/2] + samples[n/2]) / 2;
+
+    if (stats != NULL) {
+	stats->samples = n;
+	stats->runs = n * calls;
+	stats->median = median;
+	i = (int)floor(n/2.0 - 1.96*sqrt(n)/2) - 1;
+	stats->lo = samples[i < 0 ? 0 : i];
+	i = (int)ceil(n/2.0 + 1.96*sqrt(n)/2);
+	stats->hi = samples[i >= n ? n-1 : i];
+	for (i = 0; i < n; i++)
+	    samples[i] = fabs(samples[i] - median);
+	qsort(samples, n, sizeof(double), compare_doubles);
+	stats->mad = (samples[(n-1)/2] + samples[n/2]) / 2;
+    }
+    return median;
 }
 
 /*
@@ -44,14 +192,7 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
+    return fsecs_full(f, argp, NULL);
 }
 
 
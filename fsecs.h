@@ -1,4 +1,24 @@
 typedef void (*fsecs_test_funct)(void *);
 
-void init_fsecs(void);
+/* The timers fsecs can measure with */
+#define FSECS_FCYC      0 /* cycle counter */
+#define FSECS_ITIMER    1 /* interval timer */
+#define FSECS_GETTOD    2 /* gettimeofday */
+#define FSECS_MONOTONIC 3 /* clock_gettime(CLOCK_MONOTONIC_RAW) */
+#define FSECS_TIMERS    4
+
+/* The spread of the samples fsecs_full took */
+typedef struct {
+    int samples;     /* timed samples... */
+    int runs;        /* ... of this many runs in all */
+    double median;   /* median time of a run in secs, which it returns */
+    double mad;      /* median absolute deviation from it */
+    double lo, hi;   /* 95% confidence interval of the median */
+} fsecs_stats_t;
+
+int fsecs_timer(char *name);
+void init_fsecs(int which);
+char *fsecs_name(void);
+double fsecs_resolution(void);
 double fsecs(fsecs_test_funct f, void *argp);
+double fsecs_full(fsecs_test_funct f, void *argp, fsecs_stats_t *stats);
@@ -7,14 +7,19 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_monotonic: version that uses clock_gettime(CLOCK_MONOTONIC_RAW)
  */
 #include <stdio.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
 
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
+static double get_gettod(void);
+static double get_monotonic(void);
+static double resolution(double (*get)(void));
 
 /* 
  * ftimer_itimer - Use the interval timer to estimate the running time
@@ -53,6 +58,85 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
 }
 
 
+/* 
+ * ftimer_monotonic - Use clock_gettime(CLOCK_MONOTONIC_RAW), which
+ * has ns resolution and is not slewed by NTP, to estimate the running
+ * time of f(argp). Return the average of n runs.  
+ */
+double ftimer_monotonic(ftimer_test_funct f, void *argp, int n)
+{
+    double start, tmeas;
+    int i;
+
+    start = get_monotonic();
+    for (i = 0; i < n; i++) 
+	f(argp);
+    tmeas = get_monotonic() - start;
+    return tmeas / n;
+}
+
+/*
+ * Resolutions of the timers, in seconds
+ */
+double ftimer_itimer_resolution(void)
+{
+    init_etime();
+    return resolution(get_etime);
+}
+
+double ftimer_gettod_resolution(void)
+{
+    return resolution(get_gettod);
+}
+
+double ftimer_monotonic_resolution(void)
+{
+    return resolution(get_monotonic);
+}
+
+/* The smallest step seen between successive readings of a timer */
+static double resolution(double (*get)(void))
+{
+    double t, last, step, min = 0;
+    int i;
+
+    last = get();
+    for (i = 0; i < 20; i++) {
+	while ((t = get()) == last)
+	    ;
+	step = t - last;
+	if (min == 0 || step < min)
+	    min = step;
+	last = t;
+    }
+    return min;
+}
+
+/* return gettimeofday time in seconds since the first call, so
+   that a double keeps every usec */
+static double get_gettod(void)
+{
+    static time_t base = 0;
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    if (base == 0)
+	base = tv.tv_sec;
+    return (tv.tv_sec - base) + 1E-6*tv.tv_usec;
+}
+
+/* return CLOCK_MONOTONIC_RAW time in seconds since the first call */
+static double get_monotonic(void)
+{
+    static time_t base = 0;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    if (base == 0)
+	base = ts.tv_sec;
+    return (ts.tv_sec - base) + 1E-9*ts.tv_nsec;
+}
+
 /*
  * Routines for manipulating the Unix interval timer
  */
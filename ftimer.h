@@ -12,3 +12,12 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* Estimate the running time of f(argp) using clock_gettime
+   (CLOCK_MONOTONIC_RAW). Return the average of n runs */
+double ftimer_monotonic(ftimer_test_funct f, void *argp, int n);
+
+/* Measure the resolution in seconds of the timer each one uses */
+double ftimer_itimer_resolution(void);
+double ftimer_gettod_resolution(void);
+double ftimer_monotonic_resolution(void);
+
@@ -15,10 +15,16 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
 
 /**********************
@@ -27,11 +33,23 @@
 
 /* Misc */
 #define MAXLINE     1024 /* max string size */
-#define HDRLINES       4 /* number of header lines in a trace file */
-#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define HDRLINES       4 /* number of header lines in a version 1 trace */
+#define LINENUM(i) (i+hdrlines+1) /* cnvt trace request nums to linenums (origin 1) */
+#define TRACE_VERSION  2 /* newest trace format read_trace knows */
+#define BINTRACE_MAGIC 0x4d4d5442 /* first word of a binary trace */
+#define SCALE_OPS   200000 /* requests per thread in a -M scaling run */
+#define SCALE_SLOTS    256 /* blocks each -M thread keeps live at most */
+#define PAIR_OPS    200000 /* blocks each -Q producer passes to its consumer */
+#define PAIR_SLOTS     256 /* blocks in flight from one to the other at most */
+#define REPLAY_RUNS      3 /* timed -T replays of each trace, the best counts */
+#define SLOTS_MIN       64 /* slots a -R stream replay starts with */
+#define HIST_SUB_BITS    5 /* 32 histogram buckets per power of two, within 3% */
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#define HIST_WORST       3 /* slowest requests of each type reported by -O */
+#define NUM_OP_TYPES     5 /* request types of traceop_t */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -46,13 +64,18 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, CALLOC, MEMALIGN} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int arg;                          /* calloc count or memalign alignment */
+    int thread;                       /* thread of a v2 request, else 0 */
+    unsigned int usecs;               /* v2 time since the trace start */
 } traceop_t;
 
 /* Holds the information for one trace file*/
 typedef struct {
+    int version;         /* trace format, 1 unless the header says v2 */
+    int num_threads;     /* threads named by the requests */
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
@@ -60,8 +83,50 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* binary trace file the ops are in, or NULL */
+    size_t map_size;     /* its size in bytes */
 } trace_t;
 
+/* Header of a binary trace, as written by mdriver -B. The num_ops
+   requests follow as an array of traceop_t, which read_trace maps and
+   uses in place; the magic and the record size tell a trace written
+   with another byte order or layout */
+typedef struct {
+    unsigned int magic;  /* BINTRACE_MAGIC */
+    unsigned int opsize; /* sizeof(traceop_t) */
+    int version;         /* the fields of trace_t, as read from text */
+    int num_threads;
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+} bintrace_t;
+
+/* The live blocks of a -R stream replay. Each block id is remapped to
+   a slot as its requests are read, and the slots of freed blocks are
+   reused, so the tables grow with the blocks live at once rather than
+   with the ids of the trace */
+typedef struct {
+    int *ids;            /* open-addressed table of the live ids, -1 if empty... */
+    int *id_slots;       /* ... and the slot of each */
+    int table_size;      /* entries in the table, a power of two */
+    int live;            /* ids in the table */
+    int *free_slots;     /* stack of the slots of freed blocks */
+    int num_free;        /* slots on it */
+    int num_slots;       /* slots handed out so far */
+    char **blocks;       /* the block in each slot */
+} slots_t;
+
+/* Latencies of one type of request in cycles, kept in buckets
+   of equal relative width as an HDR histogram does, with the slowest
+   requests and their numbers */
+typedef struct {
+    unsigned long counts[HIST_BUCKETS];
+    unsigned long total;                 /* requests counted */
+    unsigned long long worst[HIST_WORST]; /* slowest latencies, largest first... */
+    int worst_ops[HIST_WORST];           /* ... and their request numbers */
+} hist_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,15 +137,65 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* One thread of a -M scaling run, with its own set of live blocks */
+typedef struct {
+    unsigned int seed;         /* rand_r state */
+    pthread_barrier_t *start;  /* released once every thread is ready */
+    int failed;                /* set if mm_malloc returned NULL */
+    char *slots[SCALE_SLOTS];  /* live blocks, NULL if free */
+} worker_t;
+
+/* A producer and a consumer thread of a -Q run: the producer mallocs
+   blocks and passes them through a ring to the consumer, which frees
+   them. A NULL block ends the run */
+typedef struct {
+    unsigned int seed;         /* rand_r state of the producer */
+    pthread_barrier_t *start;  /* released once every thread is ready */
+    int failed;                /* set if mm_malloc returned NULL */
+    unsigned int head;         /* blocks put in the ring so far */
+    unsigned int tail;         /* blocks taken out of it so far */
+    char *ring[PAIR_SLOTS];
+} pair_t;
+
+/* One thread of a -T replay: the ops it replays, all those of the trace,
+   those of its share of the block ids or those of its trace threads,
+   and the blocks by id, its own unless it shares ids with the others */
+typedef struct {
+    trace_t *trace;
+    int tracenum;
+    int fill;                  /* added to the id for the fill byte */
+    int num_ops;               /* number of ops this thread replays... */
+    int *opnums;               /* ... and their op numbers, NULL for all */
+    int *seqs;                 /* ordinal of each op among those of its id, */
+    unsigned int *done;        /* and ops done per id, if ids are shared */
+    int paced;                 /* wait for the time of each op */
+    range_t **ranges;          /* shared range list, NULL in a timed run */
+    pthread_barrier_t *start;  /* released once every thread is ready */
+    char **blocks;             /* blocks by id... */
+    size_t *block_sizes;       /* ... and their payload sizes */
+    int valid;                 /* cleared when the mm package fails */
+    double began, ended;       /* CLOCK_MONOTONIC seconds it ran between */
+} replay_t;
+
+/* How the ops of a trace are shared among the -T threads */
+#define REPLAY_COPY   0   /* each thread replays all of them */
+#define REPLAY_ID     1   /* by block id, modulo the threads (-S) */
+#define REPLAY_THREAD 2   /* by the thread ids of a v2 trace */
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    fsecs_stats_t timing; /* the spread of the runs secs is the median of */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t heap;     /* heap size in bytes at the end of the utilization run */
+    size_t mapped;   /* bytes in mapped regions at the end of that run */
+    size_t peak;     /* largest heap plus mapped size in bytes during it */
+    mm_stats_t mm;   /* allocator counters from the utilization run */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -100,6 +215,35 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* Names of the mm free-list policies, indexed by MM_POLICY_xxx */
+static char *policy_names[MM_POLICIES] = {
+    "LIFO", "address-ordered", "size-ordered"
+};
+
+/* Guards the range list while -T threads check their blocks */
+static pthread_mutex_t range_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Header lines of the trace being run, for LINENUM */
+static int hdrlines = HDRLINES;
+
+/* Set by a -T thread that fails, so the others stop waiting for it */
+static int replay_failed;
+
+/* Names of the mm locking modes, indexed by MM_LOCK_xxx */
+static char *locking_names[] = {
+    "class", "global"
+};
+
+/* Names of the -T replay modes, indexed by REPLAY_xxx */
+static char *replay_names[] = {
+    "copy", "id", "thread"
+};
+
+/* The mm function serving each request type */
+static char *mm_op_names[] = {
+    "mm_malloc", "mm_free", "mm_realloc", "mm_calloc", "mm_memalign"
+};
+
 
 /********************* 
  * Function prototypes 
@@ -113,6 +257,12 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_header(FILE *tracefile, trace_t *trace, char *path);
+static int read_op(FILE *tracefile, trace_t *trace, traceop_t *op,
+		   long op_index, char *path);
+static int read_binheader(FILE *tracefile, trace_t *trace, char *path);
+static int map_trace(trace_t *trace, FILE *tracefile, char *path);
+static void write_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -124,12 +274,53 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm(char *tracedir, char **tracefiles, int num_tracefiles,
+		    range_t **ranges, stats_t *stats);
+static void eval_mm_latency(char *tracedir, char **tracefiles,
+			    int num_tracefiles, stats_t *stats);
+static void eval_mm_latency_trace(trace_t *trace, hist_t *hists,
+				  double overhead);
 
 /* Various helper routines */
+static double eval_mm_threads(int threads, int locking, int arenas);
+static void *eval_mm_worker(void *arg);
+static void eval_mm_scaling(int max_threads, int tcache);
+static size_t random_size(unsigned int r);
+static double eval_mm_pairs(int pairs, int locking, int arenas, int remote);
+static void *eval_mm_producer(void *arg);
+static void *eval_mm_consumer(void *arg);
+static void eval_mm_pipeline(int max_pairs);
+static void eval_mm_replay(char *tracedir, char **tracefiles,
+			   int num_tracefiles, range_t **ranges,
+			   int threads, int split, int paced);
+static double eval_mm_replay_run(replay_t *replay, int threads,
+				 range_t **ranges);
+static void *eval_mm_replayer(void *arg);
+static void *replay_fail(replay_t *r);
+static void eval_mm_stream(char *tracedir, char **tracefiles,
+			   int num_tracefiles, int window);
+static int eval_mm_window(traceop_t *ops, int n, char **blocks,
+			  int tracenum, long first);
+static int slot_find(slots_t *slots, int id);
+static int slot_get(slots_t *slots, int id);
+static int slot_put(slots_t *slots, int id);
+
+/* Requests of the allocation types */
+static char *mm_alloc_op(traceop_t *op);
+static char *libc_alloc_op(traceop_t *op);
+static int check_alloc_op(traceop_t *op, char *p, int tracenum, int opnum);
+static double now(void);
+static void hist_add(hist_t *hist, unsigned long long value, int opnum);
+static int hist_bucket(unsigned long long value);
+static unsigned long long hist_value(hist_t *hist, double quantile);
+
 static void printresults(int n, stats_t *stats);
+static void printmmstats(int n, stats_t *stats);
+static double percent(unsigned long part, unsigned long whole);
+static size_t parse_size(char *arg);
 static void usage(void);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(int tracenum, long opnum, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -137,7 +328,7 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, p;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
@@ -150,6 +341,19 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int policies = 0;    /* If set, compare the mm free-list policies (-P) */
+    int max_threads = 0; /* If set, run the mm scaling benchmark (-M) */
+    int max_pairs = 0;   /* If set, run the producer/consumer benchmark (-Q) */
+    int replay_threads = 0; /* If set, replay the traces on threads (-T) */
+    int split = 0;       /* If set, split the block ids among them (-S) */
+    int paced = 0;       /* If set, keep to the trace timestamps (-W) */
+    char *binfile = NULL;/* If set, convert the -f trace to this file (-B) */
+    int window = 0;      /* If set, stream the traces this many ops at a time (-R) */
+    int latency = 0;     /* If set, report the latency of each request type (-O) */
+    int timer = -1;      /* FSECS_ timer to measure with, if set by -c */
+    int tcache = -1;     /* mm thread cache capacity, if set by -C */
+    size_t max_heap = MAX_HEAP; /* heap size to reserve (set by -H) */
+    int backing = MEM_BACKING_SMALL; /* pages backing the heap (set by -L) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +362,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalOPSWB:H:L:M:Q:R:T:C:c:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +388,71 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'c': /* Timer for fsecs to measure with */
+            if ((timer = fsecs_timer(optarg)) < 0)
+                app_error("ERROR: -c takes fcyc, itimer, gettod or monotonic");
+            break;
+        case 'O': /* Report the latencies of the mm requests */
+            latency = 1;
+            break;
+        case 'P': /* Compare the mm free-list policies */
+            policies = 1;
+            break;
+        case 'H': /* Size of the simulated heap */
+            if ((max_heap = parse_size(optarg)) == 0) {
+		usage();
+		exit(1);
+	    }
+            if (max_heap > MAX_HEAP_LIMIT)
+                app_error("ERROR: -H is limited to 4G, the largest heap mm.c can address");
+            break;
+        case 'L': /* Pages backing the simulated heap */
+	    for (backing = 0; backing < MEM_BACKINGS; backing++)
+		if (!strcmp(optarg, mem_backing_name(backing)))
+		    break;
+	    if (backing == MEM_BACKINGS) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'M': /* Measure mm throughput from 1 to max_threads threads */
+            if ((max_threads = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'Q': /* Measure mm throughput of 1 to max_pairs thread pairs */
+            if ((max_pairs = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'T': /* Replay each trace on replay_threads threads */
+            if ((replay_threads = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'S': /* Split the block ids of a trace among the -T threads */
+            split = 1;
+            break;
+        case 'R': /* Stream the traces through a window of ops */
+            window = atoi(optarg);
+            if (window < 1)
+                app_error("ERROR: -R needs a window of at least one request");
+            break;
+        case 'B': /* Write the -f trace to binfile as a binary trace */
+            binfile = optarg;
+            break;
+        case 'W': /* Replay v2 traces on -T threads at their own pace */
+            paced = 1;
+            break;
+        case 'C': /* Capacity of the mm thread caches */
+            if ((tcache = atoi(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -225,6 +494,19 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+    /*
+     * Optionally convert the -f trace to a binary trace and stop there
+     */
+    if (binfile != NULL) {
+	if (tracefiles == NULL)
+	    app_error("ERROR: -B converts the trace given with -f");
+	trace = read_trace(tracedir, tracefiles[0]);
+	write_trace(trace, binfile);
+	printf("Wrote %d requests to binary trace %s\n", trace->num_ops, binfile);
+	free_trace(trace);
+	exit(0);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -236,7 +518,7 @@ int main(int argc, char **argv)
     }
 
     /* Initialize the timing package */
-    init_fsecs();
+    init_fsecs(timer);
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -261,7 +543,8 @@ int main(int argc, char **argv)
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		libc_stats[i].secs = fsecs_full(eval_libc_speed, &speed_params,
+						&libc_stats[i].timing);
 	    }
 	    free_trace(trace);
 	}
@@ -285,32 +568,98 @@ int main(int argc, char **argv)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    mem_init_size(max_heap, backing); 
+    printf("Heap backed by %s pages", mem_backing_name(mem_backing()));
+    if (backing != MEM_BACKING_AUTO && backing != mem_backing())
+	printf(" (%s pages unavailable)", mem_backing_name(backing));
+    printf("\n");
+
+    if (tcache >= 0) {
+	if (mm_set_tcache == NULL)
+	    app_error("ERROR: this mm package has no thread caches");
+	mm_set_tcache(tcache);
+    }
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+    /*
+     * Optionally measure how the mm package scales with threads instead
+     * of running the traces
+     */
+    if (max_threads) {
+	if (mm_set_locking == NULL)
+	    app_error("ERROR: this mm package is not thread-safe, see mdriver-mt");
+	eval_mm_scaling(max_threads, tcache);
+	exit(0);
+    }
+
+    /*
+     * Or with blocks malloced by one thread and freed by another
+     */
+    if (max_pairs) {
+	if (mm_set_remote == NULL)
+	    app_error("ERROR: this mm package has no remote frees, see mdriver-mt");
+	eval_mm_pipeline(max_pairs);
+	exit(0);
+    }
+
+    /*
+     * Or replay the traces on several threads at once
+     */
+    if (replay_threads) {
+	if (replay_threads > 1 && mm_set_locking == NULL)
+	    app_error("ERROR: this mm package is not thread-safe, see mdriver-mt");
+	eval_mm_replay(tracedir, tracefiles, num_tracefiles, &ranges,
+		       replay_threads, split, paced);
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+
+    /*
+     * Or stream the traces a window of requests at a time
+     */
+    if (window) {
+	eval_mm_stream(tracedir, tracefiles, num_tracefiles, window);
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+
+    /* 
+     * Optionally run every free-list policy of the mm package on the
+     * same traces and report each one instead of the performance index
+     */
+    if (policies) {
+	if (mm_set_policy == NULL)
+	    app_error("ERROR: this mm package has no free-list policies");
+	for (p = 0; p < MM_POLICIES; p++) {
+	    mm_set_policy(p);
+	    eval_mm(tracedir, tracefiles, num_tracefiles, &ranges, mm_stats);
+	    printf("\nResults for mm malloc, %s policy:\n", policy_names[p]);
+	    printresults(num_tracefiles, mm_stats);
+	    if (verbose)
+		printmmstats(num_tracefiles, mm_stats);
 	}
-	free_trace(trace);
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
     }
 
+    /* Evaluate student's mm malloc package using the K-best scheme */
+    eval_mm(tracedir, tracefiles, num_tracefiles, &ranges, mm_stats);
+
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printmmstats(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Optionally time each request of the valid traces on its own */
+    if (latency) {
+	if (!verbose)
+	    printf("\n");
+	eval_mm_latency(tracedir, tracefiles, num_tracefiles, mm_stats);
 	printf("\n");
     }
 
@@ -333,6 +682,8 @@ int main(int argc, char **argv)
     /* 
      * Compute and print the performance index 
      */
+    printf("Timed by %s, resolution %.1f ns\n", fsecs_name(),
+	   fsecs_resolution() * 1e9);
     if (errors == 0) {
 	avg_mm_throughput = ops/secs;
 
@@ -395,22 +746,24 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+    /* The payload must lie within the extent of a heap, or within
+       a region the package mapped with mem_map */
+    if (!mem_is_heap(lo, size) && !mem_is_mapped(lo, size)) {
+	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p) and mapped regions",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
     /* The payload must not overlap any other payloads */
+    pthread_mutex_lock(&range_lock);
     for (p = *ranges;  p != NULL;  p = p->next) {
         if ((lo >= p->lo && lo <= p-> hi) ||
             (hi >= p->lo && hi <= p->hi)) {
 	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
 		    lo, hi, p->lo, p->hi);
 	    malloc_error(tracenum, opnum, msg);
+	    pthread_mutex_unlock(&range_lock);
 	    return 0;
         }
     }
@@ -425,6 +778,7 @@ static int add_range(range_t **ranges, char *lo, int size,
     p->lo = lo;
     p->hi = hi;
     *ranges = p;
+    pthread_mutex_unlock(&range_lock);
     return 1;
 }
 
@@ -437,6 +791,7 @@ static void remove_range(range_t **ranges, char *lo)
     range_t **prevpp = ranges;
     int size;
 
+    pthread_mutex_lock(&range_lock);
     for (p = *ranges;  p != NULL; p = p->next) {
         if (p->lo == lo) {
 	    *prevpp = p->next;
@@ -446,6 +801,7 @@ static void remove_range(range_t **ranges, char *lo)
         }
         prevpp = &(p->next);
     }
+    pthread_mutex_unlock(&range_lock);
 }
 
 /*
@@ -470,14 +826,35 @@ static void clear_ranges(range_t **ranges)
 
 /*
  * read_trace - read a trace file and store it in memory
+ *
+ *    A trace starts with four header lines: the suggested heap size
+ *    (unused), the number of block ids, the number of requests and a
+ *    weight (unused). One request per line follows:
+ *
+ *        a <id> <size>              malloc
+ *        r <id> <size>              realloc
+ *        f <id>                     free
+ *
+ *    A version 2 trace has a "v2" line in front of the header, and may
+ *    also have
+ *
+ *        c <id> <count> <size>      calloc of count elements of size bytes
+ *        m <id> <alignment> <size>  memalign, alignment a power of two
+ *
+ *    each of which may be preceded by "t<thread>", the thread that made
+ *    the request, and then "@<usecs>", its time since the trace started.
+ *    Requests are in the order they returned in, threads and times
+ *    default to 0.
+ *
+ *    A binary trace from mdriver -B is recognized by its magic number
+ *    and mapped instead, see map_trace.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
+    traceop_t *op;
     char path[MAXLINE];
-    unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -488,17 +865,19 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
 	
-    /* Read the trace file header */
+    /* Read the trace file header, after the version line if any */
     strcpy(path, tracedir);
     strcat(path, filename);
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    trace->map = NULL;
+    if (map_trace(trace, tracefile, path)) {
+	fclose(tracefile);
+	return trace;
+    }
+    read_header(tracefile, trace, path);
     
     /* We'll store each request line in the trace in this array */
     if ((trace->ops = 
@@ -516,36 +895,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	unix_error("malloc 4 failed in read_trace");
     
     /* read every request line in the trace file */
-    index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
+    while (read_op(tracefile, trace, op = &trace->ops[op_index], op_index, path)) {
+	if (op->type != FREE && (unsigned)op->index > max_index)
+	    max_index = op->index;
 	op_index++;
-	
     }
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
@@ -554,13 +908,213 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * read_header - read the version line, if any, and the header of the
+ *    text trace path into trace
+ */
+static void read_header(FILE *tracefile, trace_t *trace, char *path)
+{
+    char type[MAXLINE];
+
+    trace->version = 1;
+    fscanf(tracefile, "%s", type);
+    if (type[0] == 'v') {
+	trace->version = atoi(type + 1);
+	if (trace->version < 2 || trace->version > TRACE_VERSION) {
+	    printf("Unknown trace version %s in tracefile %s\n", type, path);
+	    exit(1);
+	}
+	fscanf(tracefile, "%s", type);
+    }
+    hdrlines = HDRLINES + (trace->version > 1);
+    trace->sugg_heapsize = atoi(type);                /* not used */
+    fscanf(tracefile, "%d", &(trace->num_ids));     
+    fscanf(tracefile, "%d", &(trace->num_ops));     
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    trace->num_threads = 1;
+}
+
+/*
+ * read_op - read request op_index of the text trace path into op.
+ *    Returns 0 at the end of the trace
+ */
+static int read_op(FILE *tracefile, trace_t *trace, traceop_t *op,
+		   long op_index, char *path)
+{
+    char type[MAXLINE];
+    unsigned index, size, arg;
+
+    if (fscanf(tracefile, "%s", type) == EOF)
+	return 0;
+    op->size = 0;
+    op->arg = 0;
+    op->thread = 0;
+    op->usecs = 0;
+
+    /* v2 requests may name their thread and time first */
+    if (trace->version > 1 && type[0] == 't') {
+	op->thread = atoi(type + 1);
+	if (op->thread >= trace->num_threads)
+	    trace->num_threads = op->thread + 1;
+	fscanf(tracefile, "%s", type);
+    }
+    if (trace->version > 1 && type[0] == '@') {
+	op->usecs = strtoul(type + 1, NULL, 10);
+	fscanf(tracefile, "%s", type);
+    }
+
+    if (trace->version < 2 && (type[0] == 'c' || type[0] == 'm')) {
+	printf("Request type %c needs a v2 tracefile: %s\n", type[0], path);
+	exit(1);
+    }
+    switch(type[0]) {
+    case 'a':
+	fscanf(tracefile, "%u %u", &index, &size);
+	op->type = ALLOC;
+	op->index = index;
+	op->size = size;
+	break;
+    case 'r':
+	fscanf(tracefile, "%u %u", &index, &size);
+	op->type = REALLOC;
+	op->index = index;
+	op->size = size;
+	break;
+    case 'f':
+	fscanf(tracefile, "%ud", &index);
+	op->type = FREE;
+	op->index = index;
+	break;
+    case 'c':
+	fscanf(tracefile, "%u %u %u", &index, &arg, &size);
+	if (arg == 0 || size == 0) {
+	    printf("Empty calloc at line %ld of tracefile %s\n",
+		   LINENUM(op_index), path);
+	    exit(1);
+	}
+	op->type = CALLOC;
+	op->index = index;
+	op->arg = arg;
+	op->size = arg * size;
+	break;
+    case 'm':
+	fscanf(tracefile, "%u %u %u", &index, &arg, &size);
+	if (arg == 0 || (arg & (arg - 1)) != 0) {
+	    printf("Bad alignment %u at line %ld of tracefile %s\n",
+		   arg, LINENUM(op_index), path);
+	    exit(1);
+	}
+	op->type = MEMALIGN;
+	op->index = index;
+	op->arg = arg;
+	op->size = size;
+	break;
+    default:
+	printf("Bogus type character (%c) in tracefile %s\n", 
+	       type[0], path);
+	exit(1);
+    }
+    return 1;
+}
+
+/*
+ * read_binheader - if path is a binary trace, read its header into
+ *    trace and return 1; otherwise rewind it and return 0
+ */
+static int read_binheader(FILE *tracefile, trace_t *trace, char *path)
+{
+    bintrace_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (fread(&hdr, sizeof(hdr), 1, tracefile) != 1 || hdr.magic != BINTRACE_MAGIC) {
+	if (hdr.magic == __builtin_bswap32(BINTRACE_MAGIC)) {
+	    printf("Binary tracefile %s has the other byte order\n", path);
+	    exit(1);
+	}
+	rewind(tracefile);
+	return 0;
+    }
+    if (hdr.opsize != sizeof(traceop_t)) {
+	printf("Binary tracefile %s is from another mdriver\n", path);
+	exit(1);
+    }
+    trace->version = hdr.version;
+    trace->num_threads = hdr.num_threads;
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+    hdrlines = HDRLINES + (trace->version > 1);
+    return 1;
+}
+
+/*
+ * map_trace - if path is a binary trace, map it and point the ops of
+ *    trace at its requests, allocate the block arrays and return 1;
+ *    return 0 for a text trace
+ */
+static int map_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    struct stat st;
+
+    if (!read_binheader(tracefile, trace, path))
+	return 0;
+    if (fstat(fileno(tracefile), &st) < 0 ||
+	(size_t)st.st_size < sizeof(bintrace_t) + (size_t)trace->num_ops * sizeof(traceop_t)) {
+	printf("Binary tracefile %s is truncated\n", path);
+	exit(1);
+    }
+
+    trace->map_size = st.st_size;
+    if ((trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE,
+			   fileno(tracefile), 0)) == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in map_trace", path);
+	unix_error(msg);
+    }
+    trace->ops = (traceop_t *)((char *)trace->map + sizeof(bintrace_t));
+
+    if ((trace->blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+	(trace->block_sizes = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in map_trace");
+    return 1;
+}
+
+/*
+ * write_trace - write trace to path as a binary trace
+ */
+static void write_trace(trace_t *trace, char *path)
+{
+    bintrace_t hdr;
+    FILE *file;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BINTRACE_MAGIC;
+    hdr.opsize = sizeof(traceop_t);
+    hdr.version = trace->version;
+    hdr.num_threads = trace->num_threads;
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    if ((file = fopen(path, "w")) == NULL ||
+	fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, file) != (size_t)trace->num_ops ||
+	fclose(file) != 0) {
+	sprintf(msg, "Could not write %s in write_trace", path);
+	unix_error(msg);
+    }
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* unmap or free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -602,19 +1156,24 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    if ((p = mm_alloc_op(&trace->ops[i])) == NULL) {
+		sprintf(msg, "%s failed.", mm_op_names[trace->ops[i].type]);
+		malloc_error(tracenum, i, msg);
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
 	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
+	     * and must not overlap any currently allocated block. A calloc
+	     * block must be zeroed and a memalign one aligned as asked.
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, tracenum, i) == 0 ||
+		check_alloc_op(&trace->ops[i], p, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -689,10 +1248,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak size of the heap plus any regions from mem_map() in bytes
+ *   while running the student's malloc package on the trace.
+ *   mem_sbrk() lets the package shrink the heap, so the final brk
+ *   may be below its high water mark.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -714,11 +1273,16 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
-		app_error("mm_malloc failed in eval_mm_util");
+	    if ((p = mm_alloc_op(&trace->ops[i])) == NULL) {
+		sprintf(msg, "%s failed in eval_mm_util",
+			mm_op_names[trace->ops[i].type]);
+		app_error(msg);
+	    }
 	    
 	    /* Remember region and size */
 	    trace->blocks[index] = p;
@@ -774,7 +1338,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_footprint_peak());
 }
 
 
@@ -784,7 +1348,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -798,10 +1362,14 @@ static void eval_mm_speed(void *ptr)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
+            if ((p = mm_alloc_op(&trace->ops[i])) == NULL) {
+		sprintf(msg, "%s error in eval_mm_speed",
+			mm_op_names[trace->ops[i].type]);
+		app_error(msg);
+	    }
             trace->blocks[index] = p;
             break;
 
@@ -825,6 +1393,1116 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm - Check, and if valid measure the utilization and speed of,
+ *    the mm malloc package on each tracefile
+ */
+static void eval_mm(char *tracedir, char **tracefiles, int num_tracefiles,
+		    range_t **ranges, stats_t *stats)
+{
+    int i;
+    trace_t *trace;
+    speed_t speed_params;
+
+    for (i=0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness, ");
+	stats[i].valid = eval_mm_valid(trace, i, ranges);
+	if (stats[i].valid) {
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    stats[i].util = eval_mm_util(trace, i, ranges);
+	    stats[i].heap = mem_heapsize();
+	    stats[i].mapped = mem_mapsize();
+	    stats[i].peak = mem_footprint_peak();
+	    if (mm_get_stats != NULL)
+		mm_get_stats(&stats[i].mm);
+	    speed_params.trace = trace;
+	    speed_params.ranges = *ranges;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats[i].secs = fsecs_full(eval_mm_speed, &speed_params,
+				       &stats[i].timing);
+	}
+	free_trace(trace);
+    }
+}
+
+/*
+ * eval_mm_latency - replay each trace the mm package ran correctly,
+ *    timing every request with the cycle counter, and report percentiles
+ *    of the latency of each type of request in ns and the lines of the
+ *    slowest ones. The cost of reading the counter is taken off, and a
+ *    counter that does not keep a constant rate is warned of
+ */
+static void eval_mm_latency(char *tracedir, char **tracefiles,
+			    int num_tracefiles, stats_t *stats)
+{
+    static double quantiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+    hist_t *hists;
+    trace_t *trace;
+    double ns_per_cycle, overhead;
+    int i, j, type;
+
+    if ((hists = (hist_t *)malloc(NUM_OP_TYPES * sizeof(hist_t))) == NULL)
+	unix_error("malloc failed in eval_mm_latency");
+
+    if (strcmp(counter_name(), "none") == 0)
+	app_error("ERROR: clock.c has no cycle counter for this platform");
+    ns_per_cycle = 1e3 / mhz(0);
+    overhead = ovhd();
+
+    printf("Latency of mm malloc requests in ns, by %s at %.1f MHz%s:\n",
+	   counter_name(), 1e3 / ns_per_cycle,
+	   counter_invariant() ? "" : " (not invariant, may vary with the clock speed)");
+    printf("%5s %-12s%9s%8s%8s%8s%8s%9s  %s\n", "trace", "request", "ops",
+	   "p50", "p90", "p99", "p99.9", "max", "slowest at lines");
+    for (i = 0; i < num_tracefiles; i++) {
+	if (!stats[i].valid)
+	    continue;
+	trace = read_trace(tracedir, tracefiles[i]);
+	memset(hists, 0, NUM_OP_TYPES * sizeof(hist_t));
+	eval_mm_latency_trace(trace, hists, overhead);
+	for (type = 0; type < NUM_OP_TYPES; type++) {
+	    if (hists[type].total == 0)
+		continue;
+	    printf("%2d    %-12s%9lu", i, mm_op_names[type], hists[type].total);
+	    for (j = 0; j < sizeof(quantiles) / sizeof(double); j++)
+		printf(j < 4 ? "%8.0f" : "%9.0f",
+		       hist_value(&hists[type], quantiles[j]) * ns_per_cycle);
+	    printf(" ");
+	    for (j = 0; j < HIST_WORST && j < hists[type].total; j++)
+		printf(" %ld", LINENUM((long)hists[type].worst_ops[j]));
+	    printf("\n");
+	}
+	free_trace(trace);
+    }
+    free(hists);
+}
+
+/*
+ * eval_mm_latency_trace - replay trace on a fresh mm heap, adding the
+ *    cycles each request took, less overhead, to the histogram of its
+ *    type
+ */
+static void eval_mm_latency_trace(trace_t *trace, hist_t *hists,
+				  double overhead)
+{
+    traceop_t *op;
+    double t = 0;
+    char *p = NULL;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	switch (op->type) {
+
+	case ALLOC: /* mm_malloc */
+	case CALLOC: /* mm_calloc */
+	case MEMALIGN: /* mm_memalign */
+	    start_counter();
+	    p = mm_alloc_op(op);
+	    t = get_counter();
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    start_counter();
+	    p = mm_realloc(trace->blocks[op->index], op->size);
+	    t = get_counter();
+	    break;
+
+	case FREE: /* mm_free */
+	    start_counter();
+	    mm_free(trace->blocks[op->index]);
+	    t = get_counter();
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	}
+	if (op->type != FREE) {
+	    if (p == NULL)
+		app_error("mm package failed in eval_mm_latency");
+	    trace->blocks[op->index] = p;
+	}
+	hist_add(&hists[op->type], t > overhead ? t - overhead : 0, i);
+    }
+}
+
+/*
+ * eval_mm_scaling - measure the throughput of the mm package with 1, 2,
+ *    4, ... max_threads threads on one heap under each locking mode and,
+ *    if it has arenas, with an arena per thread; the single heap with
+ *    the global lock is the baseline. thit is the thread-cache hit rate
+ *    of the last run of a row. The thread caches serve most of these
+ *    small requests without a lock, so unless tcache turned them off the
+ *    runs are made again without them, to measure the locked paths
+ */
+static void eval_mm_scaling(int max_threads, int tcache)
+{
+    int threads, pass, passes, cap = 0;
+    int arenas = (mm_set_arenas != NULL);
+    double global, class, split = 0, class1 = 0, split1 = 0;
+    mm_stats_t mm;
+
+    passes = (mm_set_tcache != NULL && tcache != 0) ? 2 : 1;
+    for (pass = 0; pass < passes; pass++) {
+	if (pass == 1)
+	    cap = mm_set_tcache(0);
+	printf("\nScaling of mm malloc, %d requests per thread%s:\n", SCALE_OPS,
+	       passes == 1 ? "" : pass == 0 ? ", thread caches on" :
+	       ", thread caches off");
+	printf("%7s%13s%13s%10s%10s", "threads", "global Kops", "class Kops",
+	       "vs global", "vs 1");
+	if (arenas)
+	    printf("%13s%10s%10s", "arena Kops", "vs global", "vs 1");
+	if (mm_get_stats != NULL)
+	    printf("%6s", "thit");
+	printf("\n");
+	for (threads = 1; ; threads *= 2) {
+	    if (threads > max_threads)
+		threads = max_threads;
+	    global = eval_mm_threads(threads, MM_LOCK_GLOBAL, 1);
+	    class = eval_mm_threads(threads, MM_LOCK_CLASS, 1);
+	    if (arenas)
+		split = eval_mm_threads(threads, MM_LOCK_CLASS, threads);
+	    if (threads == 1) {
+		class1 = class;
+		split1 = split;
+	    }
+	    printf("%7d%13.0f%13.0f%9.2fx%9.2fx", threads, global/1e3,
+		   class/1e3, class/global, class/class1);
+	    if (arenas)
+		printf("%13.0f%9.2fx%9.2fx", split/1e3, split/global, split/split1);
+	    if (mm_get_stats != NULL) {
+		mm_get_stats(&mm);
+		printf("%5.0f%%", percent(mm.tcache_hits,
+					  mm.tcache_hits + mm.tcache_misses));
+	    }
+	    printf("\n");
+	    if (threads == max_threads)
+		break;
+	}
+    }
+    if (passes == 2)
+	mm_set_tcache(cap);
+    if (arenas)
+	mm_set_arenas(1, MM_ARENA_THREAD);
+}
+
+/*
+ * eval_mm_threads - run threads workers on a fresh mm heap with the
+ *    given locking mode and number of arenas, and return the requests
+ *    per second of them all
+ */
+static double eval_mm_threads(int threads, int locking, int arenas)
+{
+    pthread_barrier_t start;
+    pthread_t *tids;
+    worker_t *workers;
+    struct timespec t0, t1;
+    int i;
+
+    if ((tids = (pthread_t *)calloc(threads, sizeof(pthread_t))) == NULL ||
+	(workers = (worker_t *)calloc(threads, sizeof(worker_t))) == NULL)
+	unix_error("eval_mm_threads calloc failed");
+    mem_reset_brk();
+    mm_set_locking(locking);
+    if (mm_set_arenas != NULL)
+	mm_set_arenas(arenas, MM_ARENA_THREAD);
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_threads");
+
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for (i = 0; i < threads; i++) {
+	workers[i].seed = i + 1;
+	workers[i].start = &start;
+	if (pthread_create(&tids[i], NULL, eval_mm_worker, &workers[i]) != 0)
+	    unix_error("pthread_create failed in eval_mm_threads");
+    }
+    pthread_barrier_wait(&start);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < threads; i++)
+	pthread_join(tids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&start);
+
+    for (i = 0; i < threads; i++)
+	if (workers[i].failed) {
+	    sprintf(msg, "mm_malloc failed in a %s locking run with %d threads"
+		    " and %d arenas", locking_names[locking], threads, arenas);
+	    app_error(msg);
+	}
+    free(tids);
+    free(workers);
+    return (double)threads * SCALE_OPS /
+	(t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+/*
+ * eval_mm_worker - mallocs and frees on random slots of one thread
+ */
+static void *eval_mm_worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    unsigned int r;
+    int i, slot;
+
+    pthread_barrier_wait(w->start);
+    for (i = 0; i < SCALE_OPS; i++) {
+	r = rand_r(&w->seed);
+	slot = r % SCALE_SLOTS;
+	if (w->slots[slot] != NULL) {
+	    mm_free(w->slots[slot]);
+	    w->slots[slot] = NULL;
+	    continue;
+	}
+	if ((w->slots[slot] = mm_malloc(random_size(r / SCALE_SLOTS))) == NULL) {
+	    w->failed = 1;
+	    break;
+	}
+	*w->slots[slot] = (char)i;
+    }
+    for (slot = 0; slot < SCALE_SLOTS; slot++)
+	if (w->slots[slot] != NULL)
+	    mm_free(w->slots[slot]);
+    return NULL;
+}
+
+/*
+ * random_size - the request size of a -M or -Q block drawn from r:
+ *    mostly slab-sized, some quick-list sized, a few larger
+ */
+static size_t random_size(unsigned int r)
+{
+    if (r % 16 < 10)
+	return 1 + r / 16 % 64;
+    else if (r % 16 < 15)
+	return 65 + r / 16 % 448;
+    else
+	return 513 + r / 16 % 3584;
+}
+
+/*
+ * eval_mm_pipeline - measure the throughput of the mm package with 1, 2,
+ *    4, ... max_pairs producer/consumer pairs: on one heap with the
+ *    global lock, then with an arena per thread freeing straight into
+ *    the producer's arena and through its remote list. rfree is the
+ *    share of the frees of the last run that went through a remote
+ *    list, batch the mean number of blocks drained at once
+ */
+static void eval_mm_pipeline(int max_pairs)
+{
+    int pairs;
+    double global, arena, remote;
+    mm_stats_t mm;
+
+    printf("\nProducer/consumer pairs of mm malloc, %d blocks per pair:\n",
+	   PAIR_OPS);
+    printf("%7s%13s%13s%13s%10s", "pairs", "global Kops", "arena Kops",
+	   "remote Kops", "vs arena");
+    if (mm_get_stats != NULL)
+	printf("%7s%7s", "rfree", "batch");
+    printf("\n");
+    for (pairs = 1; ; pairs *= 2) {
+	if (pairs > max_pairs)
+	    pairs = max_pairs;
+	global = eval_mm_pairs(pairs, MM_LOCK_GLOBAL, 1, 0);
+	arena = eval_mm_pairs(pairs, MM_LOCK_CLASS, 2 * pairs, 0);
+	remote = eval_mm_pairs(pairs, MM_LOCK_CLASS, 2 * pairs, 1);
+	printf("%7d%13.0f%13.0f%13.0f%9.2fx", pairs, global/1e3, arena/1e3,
+	       remote/1e3, remote/arena);
+	if (mm_get_stats != NULL) {
+	    mm_get_stats(&mm);
+	    printf("%6.0f%%%7.1f",
+		   percent(mm.remote_frees, (unsigned long)pairs * PAIR_OPS),
+		   mm.remote_drains ? (double)mm.remote_frees / mm.remote_drains : 0.0);
+	}
+	printf("\n");
+	if (pairs == max_pairs)
+	    break;
+    }
+    mm_set_arenas(1, MM_ARENA_THREAD);
+    mm_set_remote(1);
+}
+
+/*
+ * eval_mm_pairs - run pairs producer/consumer pairs on a fresh mm heap
+ *    with the given locking mode, number of arenas and remote frees on
+ *    or off, and return the mallocs and frees per second of them all
+ */
+static double eval_mm_pairs(int pairs, int locking, int arenas, int remote)
+{
+    pthread_barrier_t start;
+    pthread_t *tids;
+    pair_t *pair;
+    struct timespec t0, t1;
+    int i;
+
+    if ((tids = (pthread_t *)calloc(2 * pairs, sizeof(pthread_t))) == NULL ||
+	(pair = (pair_t *)calloc(pairs, sizeof(pair_t))) == NULL)
+	unix_error("eval_mm_pairs calloc failed");
+    mem_reset_brk();
+    mm_set_locking(locking);
+    mm_set_arenas(arenas, MM_ARENA_THREAD);
+    mm_set_remote(remote);
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_pairs");
+
+    pthread_barrier_init(&start, NULL, 2 * pairs + 1);
+    for (i = 0; i < pairs; i++) {
+	pair[i].seed = i + 1;
+	pair[i].start = &start;
+	if (pthread_create(&tids[2*i], NULL, eval_mm_producer, &pair[i]) != 0 ||
+	    pthread_create(&tids[2*i+1], NULL, eval_mm_consumer, &pair[i]) != 0)
+	    unix_error("pthread_create failed in eval_mm_pairs");
+    }
+    pthread_barrier_wait(&start);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < 2 * pairs; i++)
+	pthread_join(tids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&start);
+
+    for (i = 0; i < pairs; i++)
+	if (pair[i].failed) {
+	    sprintf(msg, "mm_malloc failed in a %s locking run with %d pairs"
+		    " and %d arenas", locking_names[locking], pairs, arenas);
+	    app_error(msg);
+	}
+    free(tids);
+    free(pair);
+    return 2.0 * pairs * PAIR_OPS /
+	(t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+/*
+ * eval_mm_producer - malloc random blocks and pass them to the consumer,
+ *    waiting while the ring is full
+ */
+static void *eval_mm_producer(void *arg)
+{
+    pair_t *p = (pair_t *)arg;
+    char *bp;
+    int i;
+
+    pthread_barrier_wait(p->start);
+    for (i = 0; i <= PAIR_OPS; i++) {
+	bp = NULL;
+	if (i < PAIR_OPS && (bp = mm_malloc(random_size(rand_r(&p->seed)))) == NULL)
+	    p->failed = 1;
+	else if (bp != NULL)
+	    *bp = (char)i;
+	while (p->head - __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) == PAIR_SLOTS)
+	    sched_yield();
+	p->ring[p->head % PAIR_SLOTS] = bp;
+	__atomic_store_n(&p->head, p->head + 1, __ATOMIC_RELEASE);
+	if (bp == NULL)
+	    break;
+    }
+    return NULL;
+}
+
+/*
+ * eval_mm_consumer - free the blocks of the producer as they come,
+ *    until the NULL one
+ */
+static void *eval_mm_consumer(void *arg)
+{
+    pair_t *p = (pair_t *)arg;
+    char *bp;
+
+    pthread_barrier_wait(p->start);
+    do {
+	while (p->tail == __atomic_load_n(&p->head, __ATOMIC_ACQUIRE))
+	    sched_yield();
+	bp = p->ring[p->tail % PAIR_SLOTS];
+	__atomic_store_n(&p->tail, p->tail + 1, __ATOMIC_RELEASE);
+	mm_free(bp);
+    } while (bp != NULL);
+    return NULL;
+}
+
+/*
+ * eval_mm_replay - replay each trace on threads threads at once: each on
+ *    its own copy, or the ops of the trace threads equal to its thread
+ *    number modulo threads in a v2 trace with thread ids, or with -S
+ *    those of the block ids equal to it modulo threads. An op on a block
+ *    shared by threads waits for the ones before it. The blocks of all
+ *    threads are checked against one range list, then the best of
+ *    REPLAY_RUNS timed replays is reported for the trace and each thread.
+ *    If paced is set, each op also waits until its time in the trace
+ */
+static void eval_mm_replay(char *tracedir, char **tracefiles,
+			   int num_tracefiles, range_t **ranges,
+			   int threads, int split, int paced)
+{
+    trace_t *trace;
+    replay_t *replay;
+    double *secs;
+    double best, run, ops, total_ops = 0, total_secs = 0;
+    int i, j, t, mode, owner;
+    int *seqs;
+    unsigned int *count;
+
+    if ((replay = (replay_t *)calloc(threads, sizeof(replay_t))) == NULL ||
+	(secs = (double *)calloc(threads, sizeof(double))) == NULL)
+	unix_error("eval_mm_replay calloc failed");
+    if (mm_set_locking != NULL)
+	mm_set_locking(MM_LOCK_CLASS);
+    if (mm_set_arenas != NULL)
+	mm_set_arenas(threads, MM_ARENA_THREAD);
+
+    printf("\nReplay of mm malloc on %d threads%s:\n", threads,
+	   paced ? ", at the pace of the traces" : "");
+    printf("%5s%7s%7s %8s%10s%8s  %s\n", "trace", " valid", "by", "ops",
+	   "secs", "Kops", "Kops per thread");
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	mode = split ? REPLAY_ID : (trace->num_threads > 1) ? REPLAY_THREAD : REPLAY_COPY;
+
+	/* Threads sharing ids share the blocks, and wait for their turn */
+	seqs = NULL;
+	count = NULL;
+	if (mode == REPLAY_THREAD) {
+	    if ((seqs = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+		(count = (unsigned int *)calloc(trace->num_ids, sizeof(unsigned int))) == NULL)
+		unix_error("malloc failed in eval_mm_replay");
+	    for (j = 0; j < trace->num_ops; j++)
+		seqs[j] = count[trace->ops[j].index]++;
+	}
+
+	ops = 0;
+	for (t = 0; t < threads; t++) {
+	    replay[t].trace = trace;
+	    replay[t].tracenum = i;
+	    replay[t].fill = (mode == REPLAY_COPY) ? t : 0;
+	    replay[t].num_ops = trace->num_ops;
+	    replay[t].opnums = NULL;
+	    replay[t].seqs = seqs;
+	    replay[t].done = count;
+	    replay[t].paced = paced;
+	    if (mode != REPLAY_COPY) {
+		if ((replay[t].opnums = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+		    unix_error("malloc failed in eval_mm_replay");
+		replay[t].num_ops = 0;
+		for (j = 0; j < trace->num_ops; j++) {
+		    owner = (mode == REPLAY_ID) ? trace->ops[j].index : trace->ops[j].thread;
+		    if (owner % threads == t)
+			replay[t].opnums[replay[t].num_ops++] = j;
+		}
+	    }
+	    if (mode == REPLAY_THREAD && t > 0) {
+		replay[t].blocks = replay[0].blocks;
+		replay[t].block_sizes = replay[0].block_sizes;
+	    }
+	    else if ((replay[t].blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+		(replay[t].block_sizes = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+		unix_error("malloc failed in eval_mm_replay");
+	    ops += replay[t].num_ops;
+	}
+
+	best = 0;
+	if (eval_mm_replay_run(replay, threads, ranges) > 0) {
+	    for (j = 0; j < REPLAY_RUNS; j++) {
+		if ((run = eval_mm_replay_run(replay, threads, NULL)) == 0)
+		    break;
+		if (best == 0 || run < best) {
+		    best = run;
+		    for (t = 0; t < threads; t++)
+			secs[t] = replay[t].ended - replay[t].began;
+		}
+	    }
+	}
+	clear_ranges(ranges);
+
+	if (best > 0) {
+	    printf("%2d%10s%7s%9.0f%10.6f%8.0f ", i, "yes", replay_names[mode],
+		   ops, best, ops/1e3/best);
+	    for (t = 0; t < threads; t++)
+		printf("%6.0f", secs[t] > 0 ? replay[t].num_ops/1e3/secs[t] : 0.0);
+	    printf("\n");
+	    total_ops += ops;
+	    total_secs += best;
+	}
+	else
+	    printf("%2d%10s%7s%9s%10s%8s\n", i, "no", replay_names[mode],
+		   "-", "-", "-");
+
+	for (t = 0; t < threads; t++) {
+	    free(replay[t].opnums);
+	    if (mode != REPLAY_THREAD || t == 0) {
+		free(replay[t].blocks);
+		free(replay[t].block_sizes);
+	    }
+	}
+	free(seqs);
+	free(count);
+	free_trace(trace);
+    }
+    if (errors == 0)
+	printf("%19s%9.0f%10.6f%8.0f\n", "Total              ", total_ops,
+	       total_secs, total_ops/1e3/total_secs);
+    free(replay);
+    free(secs);
+}
+
+/*
+ * eval_mm_replay_run - replay a trace once on a fresh mm heap with the
+ *    threads of replay, checking their blocks against ranges unless it
+ *    is NULL. Returns the time from the first thread starting to the
+ *    last one finishing, or 0 if the mm package failed
+ */
+static double eval_mm_replay_run(replay_t *replay, int threads,
+				 range_t **ranges)
+{
+    pthread_barrier_t start;
+    pthread_t *tids;
+    double first, last;
+    int t, valid = 1;
+
+    if ((tids = (pthread_t *)calloc(threads, sizeof(pthread_t))) == NULL)
+	unix_error("eval_mm_replay_run calloc failed");
+    mem_reset_brk();
+    if (ranges != NULL)
+	clear_ranges(ranges);
+    if (replay[0].done != NULL)
+	memset(replay[0].done, 0, replay[0].trace->num_ids * sizeof(unsigned int));
+    replay_failed = 0;
+    if (mm_init() < 0) {
+	malloc_error(replay[0].tracenum, 0, "mm_init failed.");
+	free(tids);
+	return 0;
+    }
+
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for (t = 0; t < threads; t++) {
+	replay[t].ranges = ranges;
+	replay[t].start = &start;
+	replay[t].valid = 1;
+	if (pthread_create(&tids[t], NULL, eval_mm_replayer, &replay[t]) != 0)
+	    unix_error("pthread_create failed in eval_mm_replay_run");
+    }
+    pthread_barrier_wait(&start);
+    for (t = 0; t < threads; t++)
+	pthread_join(tids[t], NULL);
+    pthread_barrier_destroy(&start);
+    free(tids);
+
+    /* The threads may all be done before this one runs again */
+    first = replay[0].began;
+    last = replay[0].ended;
+    for (t = 0; t < threads; t++) {
+	valid &= replay[t].valid;
+	first = (replay[t].began < first) ? replay[t].began : first;
+	last = (replay[t].ended > last) ? replay[t].ended : last;
+    }
+    if (!valid)
+	return 0;
+    return last - first;
+}
+
+/*
+ * eval_mm_replayer - replay the ops of one -T thread, checking its blocks
+ *    as eval_mm_valid does when it has a range list. A realloc'd block
+ *    leaves the list before mm_realloc, so that another thread may get
+ *    its old payload at once
+ */
+static void *eval_mm_replayer(void *arg)
+{
+    replay_t *r = (replay_t *)arg;
+    traceop_t *op;
+    int i, j, opnum, index, size, oldsize, fill;
+    char *p, *oldp;
+    char msg[MAXLINE];
+
+    pthread_barrier_wait(r->start);
+    r->began = now();
+    for (i = 0; i < r->num_ops; i++) {
+	opnum = r->opnums ? r->opnums[i] : i;
+	op = &r->trace->ops[opnum];
+	index = op->index;
+	size = op->size;
+	fill = (index + r->fill) & 0xFF;
+
+	/* Wait for the ops of other threads before this one on its block,
+	   and for its time */
+	if (r->seqs != NULL)
+	    while (__atomic_load_n(&r->done[index], __ATOMIC_ACQUIRE) != r->seqs[opnum]) {
+		if (__atomic_load_n(&replay_failed, __ATOMIC_RELAXED))
+		    return replay_fail(r);
+		sched_yield();
+	    }
+	if (r->paced)
+	    while (now() - r->began < op->usecs / 1e6)
+		sched_yield();
+
+	switch (op->type) {
+
+	case ALLOC: /* mm_malloc */
+	case CALLOC: /* mm_calloc */
+	case MEMALIGN: /* mm_memalign */
+	    if ((p = mm_alloc_op(op)) == NULL) {
+		sprintf(msg, "%s failed.", mm_op_names[op->type]);
+		malloc_error(r->tracenum, opnum, msg);
+		return replay_fail(r);
+	    }
+	    if (r->ranges != NULL) {
+		if (add_range(r->ranges, p, size, r->tracenum, opnum) == 0 ||
+		    check_alloc_op(op, p, r->tracenum, opnum) == 0)
+		    return replay_fail(r);
+		memset(p, fill, size);
+	    }
+	    r->blocks[index] = p;
+	    r->block_sizes[index] = size;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    oldp = r->blocks[index];
+	    if (r->ranges != NULL)
+		remove_range(r->ranges, oldp);
+	    if ((p = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(r->tracenum, opnum, "mm_realloc failed.");
+		return replay_fail(r);
+	    }
+	    if (r->ranges != NULL) {
+		if (add_range(r->ranges, p, size, r->tracenum, opnum) == 0)
+		    return replay_fail(r);
+		oldsize = r->block_sizes[index];
+		if (size < oldsize)
+		    oldsize = size;
+		for (j = 0; j < oldsize; j++)
+		    if ((unsigned char)p[j] != fill) {
+			malloc_error(r->tracenum, opnum, "mm_realloc did not "
+				     "preserve the data from old block");
+			return replay_fail(r);
+		    }
+		memset(p, fill, size);
+	    }
+	    r->blocks[index] = p;
+	    r->block_sizes[index] = size;
+	    break;
+
+	case FREE: /* mm_free */
+	    if (r->ranges != NULL)
+		remove_range(r->ranges, r->blocks[index]);
+	    mm_free(r->blocks[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_replayer");
+	}
+	if (r->seqs != NULL)
+	    __atomic_store_n(&r->done[index], r->seqs[opnum] + 1, __ATOMIC_RELEASE);
+    }
+    r->ended = now();
+    return NULL;
+}
+
+/*
+ * replay_fail - give up on the replay of one -T thread, and have the
+ *    others stop waiting for it
+ */
+static void *replay_fail(replay_t *r)
+{
+    r->valid = 0;
+    __atomic_store_n(&replay_failed, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/*
+ * eval_mm_stream - replay each trace on the mm package without holding
+ *    it in memory: read window requests at a time, remap their block ids
+ *    to slots, then replay and time them, reporting the throughput and
+ *    live blocks after each window. Only the cheap checks are made, of
+ *    failed and misaligned requests; the full checks are eval_mm_valid's
+ */
+static void eval_mm_stream(char *tracedir, char **tracefiles,
+			   int num_tracefiles, int window)
+{
+    FILE *tracefile;
+    trace_t trace;
+    traceop_t *ops, *op;
+    slots_t slots;
+    char path[MAXLINE];
+    int i, n, w, binary, valid;
+    long opnum;
+    double start, secs, ops_secs, total_ops = 0, total_secs = 0;
+
+    if ((ops = (traceop_t *)malloc(window * sizeof(traceop_t))) == NULL)
+	unix_error("malloc failed in eval_mm_stream");
+    memset(&slots, 0, sizeof(slots));
+
+    printf("\nStreaming replay of mm malloc, %d requests per window:\n", window);
+    printf("%5s%7s%12s%9s%10s%10s%8s\n", "trace", "window", "ops", "live",
+	   "heap KB", "secs", "Kops");
+    for (i = 0; i < num_tracefiles; i++) {
+	strcpy(path, tracedir);
+	strcat(path, tracefiles[i]);
+	if ((tracefile = fopen(path, "r")) == NULL) {
+	    sprintf(msg, "Could not open %s in eval_mm_stream", path);
+	    unix_error(msg);
+	}
+	if (!(binary = read_binheader(tracefile, &trace, path)))
+	    read_header(tracefile, &trace, path);
+
+	/* Start with no live blocks on a fresh heap */
+	slots.live = slots.num_free = slots.num_slots = 0;
+	if (slots.table_size > 0)
+	    memset(slots.ids, -1, slots.table_size * sizeof(int));
+	mem_reset_brk();
+	if (mm_init() < 0) {
+	    malloc_error(i, 0, "mm_init failed.");
+	    fclose(tracefile);
+	    continue;
+	}
+
+	valid = 1;
+	opnum = 0;
+	ops_secs = 0;
+	for (w = 0; valid; w++) {
+	    if (binary)
+		n = fread(ops, sizeof(traceop_t), window, tracefile);
+	    else
+		for (n = 0; n < window && read_op(tracefile, &trace, &ops[n],
+						  opnum + n, path); n++)
+		    ;
+	    if (n == 0)
+		break;
+
+	    /* Replay by slot: a realloc of an unknown id is a malloc */
+	    for (op = ops; op < ops + n && valid; op++) {
+		if (op->type != FREE && op->type != REALLOC &&
+		    slot_find(&slots, op->index) >= 0) {
+		    malloc_error(i, opnum + (op - ops), "Block id allocated twice.");
+		    valid = 0;
+		}
+		else if (op->type == FREE) {
+		    if (slot_find(&slots, op->index) < 0) {
+			malloc_error(i, opnum + (op - ops), "Free of a block id not allocated.");
+			valid = 0;
+		    }
+		    else
+			op->index = slot_put(&slots, op->index);
+		}
+		else {
+		    if (op->type == REALLOC && slot_find(&slots, op->index) < 0)
+			op->type = ALLOC;
+		    op->index = slot_get(&slots, op->index);
+		}
+	    }
+	    if (!valid)
+		break;
+
+	    start = now();
+	    valid = eval_mm_window(ops, n, slots.blocks, i, opnum);
+	    secs = now() - start;
+	    opnum += n;
+	    ops_secs += secs;
+	    if (valid)
+		printf("%2d%9d%12ld%9d%10.1f%10.6f%8.0f\n", i, w, opnum,
+		       slots.live, mem_heapsize() / 1024.0, secs,
+		       secs > 0 ? n/1e3/secs : 0.0);
+	    fflush(stdout);
+	}
+	fclose(tracefile);
+
+	if (valid) {
+	    printf("%2d%9s%12ld%9s%10s%10.6f%8.0f\n", i, "all", opnum, "", "",
+		   ops_secs, ops_secs > 0 ? opnum/1e3/ops_secs : 0.0);
+	    total_ops += opnum;
+	    total_secs += ops_secs;
+	}
+    }
+    if (errors == 0)
+	printf("%-11s%12.0f%19s%10.6f%8.0f\n", "Total", total_ops, "",
+	       total_secs, total_secs > 0 ? total_ops/1e3/total_secs : 0.0);
+    free(ops);
+    free(slots.ids);
+    free(slots.id_slots);
+    free(slots.free_slots);
+    free(slots.blocks);
+}
+
+/*
+ * eval_mm_window - replay the n requests of a -R window, whose indexes
+ *    are slots in blocks, and first is the number of the first one.
+ *    Returns 0 if the mm package failed
+ */
+static int eval_mm_window(traceop_t *ops, int n, char **blocks,
+			  int tracenum, long first)
+{
+    traceop_t *op;
+    char *p;
+
+    for (op = ops; op < ops + n; op++) {
+	switch (op->type) {
+
+	case ALLOC: /* mm_malloc */
+	case CALLOC: /* mm_calloc */
+	case MEMALIGN: /* mm_memalign */
+	    p = mm_alloc_op(op);
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    p = mm_realloc(blocks[op->index], op->size);
+	    break;
+
+	case FREE: /* mm_free */
+	    mm_free(blocks[op->index]);
+	    continue;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_window");
+	    return 0;
+	}
+	if (p == NULL || !IS_ALIGNED(p)) {
+	    sprintf(msg, "%s %s.", mm_op_names[op->type],
+		    p == NULL ? "failed" : "returned a misaligned block");
+	    malloc_error(tracenum, first + (op - ops), msg);
+	    return 0;
+	}
+	blocks[op->index] = p;
+    }
+    return 1;
+}
+
+/*
+ * slot_find - position of id in the table of live ids, or -1
+ */
+static int slot_find(slots_t *slots, int id)
+{
+    int i, mask = slots->table_size - 1;
+
+    if (slots->table_size == 0)
+	return -1;
+    for (i = (id * 2654435761u) & mask; slots->ids[i] != -1; i = (i + 1) & mask)
+	if (slots->ids[i] == id)
+	    return i;
+    return -1;
+}
+
+/*
+ * slot_get - slot of the live id, given a free one if it has none yet.
+ *    The table is kept at most half full and the slot arrays grow by
+ *    doubling
+ */
+static int slot_get(slots_t *slots, int id)
+{
+    int i, j, mask, old_size, *old_ids, *old_slots;
+
+    if ((i = slot_find(slots, id)) >= 0)
+	return slots->id_slots[i];
+
+    /* Grow the table, and the slot arrays with it */
+    if (2 * (slots->live + 1) > slots->table_size) {
+	old_size = slots->table_size;
+	old_ids = slots->ids;
+	old_slots = slots->id_slots;
+	slots->table_size = old_size ? 2 * old_size : SLOTS_MIN;
+	if ((slots->ids = (int *)malloc(slots->table_size * sizeof(int))) == NULL ||
+	    (slots->id_slots = (int *)malloc(slots->table_size * sizeof(int))) == NULL ||
+	    (slots->free_slots = (int *)realloc(slots->free_slots,
+			slots->table_size / 2 * sizeof(int))) == NULL ||
+	    (slots->blocks = (char **)realloc(slots->blocks,
+			slots->table_size / 2 * sizeof(char *))) == NULL)
+	    unix_error("malloc failed in slot_get");
+	memset(slots->ids, -1, slots->table_size * sizeof(int));
+	mask = slots->table_size - 1;
+	for (j = 0; j < old_size; j++)
+	    if (old_ids[j] != -1) {
+		for (i = (old_ids[j] * 2654435761u) & mask; slots->ids[i] != -1;
+		     i = (i + 1) & mask)
+		    ;
+		slots->ids[i] = old_ids[j];
+		slots->id_slots[i] = old_slots[j];
+	    }
+	free(old_ids);
+	free(old_slots);
+    }
+
+    mask = slots->table_size - 1;
+    for (i = (id * 2654435761u) & mask; slots->ids[i] != -1; i = (i + 1) & mask)
+	;
+    slots->ids[i] = id;
+    slots->id_slots[i] = slots->num_free ? slots->free_slots[--slots->num_free]
+	                                 : slots->num_slots++;
+    slots->live++;
+    return slots->id_slots[i];
+}
+
+/*
+ * slot_put - take the live id out of the table and free its slot, which
+ *    is returned. The entries after it in its run move back, so no
+ *    lookup passes a hole
+ */
+static int slot_put(slots_t *slots, int id)
+{
+    int i, j, home, slot, mask = slots->table_size - 1;
+
+    i = slot_find(slots, id);
+    slot = slots->id_slots[i];
+    slots->free_slots[slots->num_free++] = slot;
+    slots->live--;
+    for (j = (i + 1) & mask; slots->ids[j] != -1; j = (j + 1) & mask) {
+	home = (slots->ids[j] * 2654435761u) & mask;
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    slots->ids[i] = slots->ids[j];
+	    slots->id_slots[i] = slots->id_slots[j];
+	    i = j;
+	}
+    }
+    slots->ids[i] = -1;
+    return slot;
+}
+
+/*
+ * mm_alloc_op - call the mm package for an ALLOC, CALLOC or MEMALIGN
+ *    request. A package without mm_calloc gets an mm_malloc block zeroed
+ *    here; one without mm_memalign fails alignments above ALIGNMENT
+ */
+static char *mm_alloc_op(traceop_t *op)
+{
+    char *p;
+
+    switch (op->type) {
+    case CALLOC:
+	if (mm_calloc != NULL)
+	    return mm_calloc(op->arg, op->size / op->arg);
+	if ((p = mm_malloc(op->size)) != NULL)
+	    memset(p, 0, op->size);
+	return p;
+    case MEMALIGN:
+	if (mm_memalign != NULL)
+	    return mm_memalign(op->arg, op->size);
+	return (op->arg <= ALIGNMENT) ? mm_malloc(op->size) : NULL;
+    default:
+	return mm_malloc(op->size);
+    }
+}
+
+/*
+ * libc_alloc_op - call libc for an ALLOC, CALLOC or MEMALIGN request
+ */
+static char *libc_alloc_op(traceop_t *op)
+{
+    void *p;
+
+    switch (op->type) {
+    case CALLOC:
+	return calloc(op->arg, op->size / op->arg);
+    case MEMALIGN:
+	if (posix_memalign(&p, (op->arg < sizeof(void *)) ? sizeof(void *) : op->arg,
+			   op->size) != 0)
+	    return NULL;
+	return p;
+    default:
+	return malloc(op->size);
+    }
+}
+
+/*
+ * check_alloc_op - check that the block p of a calloc request is zeroed
+ *    and that of a memalign request aligned as asked
+ */
+static int check_alloc_op(traceop_t *op, char *p, int tracenum, int opnum)
+{
+    int i;
+
+    if (op->type == MEMALIGN && (unsigned long)p % op->arg != 0) {
+	malloc_error(tracenum, opnum, "mm_memalign returned a misaligned block");
+	return 0;
+    }
+    if (op->type == CALLOC)
+	for (i = 0; i < op->size; i++)
+	    if (p[i] != 0) {
+		malloc_error(tracenum, opnum, "mm_calloc returned a block that "
+			     "is not zeroed");
+		return 0;
+	    }
+    return 1;
+}
+
+/*
+ * hist_add - count value, the latency of request opnum, in hist
+ */
+static void hist_add(hist_t *hist, unsigned long long value, int opnum)
+{
+    int i;
+
+    /* Insert it among the slowest, largest first */
+    i = (hist->total < HIST_WORST) ? hist->total : HIST_WORST;
+    for (; i > 0 && value > hist->worst[i-1]; i--)
+	if (i < HIST_WORST) {
+	    hist->worst[i] = hist->worst[i-1];
+	    hist->worst_ops[i] = hist->worst_ops[i-1];
+	}
+    hist->counts[hist_bucket(value)]++;
+    hist->total++;
+    if (i < HIST_WORST) {
+	hist->worst[i] = value;
+	hist->worst_ops[i] = opnum;
+    }
+}
+
+/*
+ * hist_bucket - bucket of value: values below 2^HIST_SUB_BITS each have
+ *    their own, and every power of two above is split in as many
+ */
+static int hist_bucket(unsigned long long value)
+{
+    int e;
+
+    if (value < (1 << HIST_SUB_BITS))
+	return value;
+    e = 63 - __builtin_clzll(value);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+	(value >> (e - HIST_SUB_BITS)) - (1 << HIST_SUB_BITS);
+}
+
+/*
+ * hist_value - the latency quantile of the requests in hist fall under:
+ *    the highest value in its bucket, or the slowest one for 1.0
+ */
+static unsigned long long hist_value(hist_t *hist, double quantile)
+{
+    unsigned long seen = 0, rank;
+    unsigned long long high;
+    int i, e, sub;
+
+    if (quantile >= 1.0)
+	return hist->worst[0];
+    rank = (unsigned long)(quantile * hist->total + 0.999999);
+    if (rank == 0)
+	rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++)
+	if ((seen += hist->counts[i]) >= rank)
+	    break;
+    if (i < (1 << HIST_SUB_BITS))
+	return i;
+    e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    sub = i & ((1 << HIST_SUB_BITS) - 1);
+    high = ((unsigned long long)(sub + (1 << HIST_SUB_BITS) + 1) << (e - HIST_SUB_BITS)) - 1;
+    return (high < hist->worst[0]) ? high : hist->worst[0];
+}
+
+/*
+ * now - CLOCK_MONOTONIC time in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -840,7 +2518,9 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+        case CALLOC: /* calloc */
+        case MEMALIGN: /* posix_memalign */
+	    if ((p = libc_alloc_op(&trace->ops[i])) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
@@ -877,16 +2557,17 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 static void eval_libc_speed(void *ptr)
 {
     int i;
-    int index, size, newsize;
+    int index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
+        case CALLOC: /* calloc */
+        case MEMALIGN: /* posix_memalign */
 	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
+	    if ((p = libc_alloc_op(&trace->ops[i])) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
@@ -916,7 +2597,10 @@ static void eval_libc_speed(void *ptr)
 
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * printresults - prints a performance summary for some malloc package.
+ *    secs is the median run, with its median absolute deviation and 95%
+ *    confidence interval. The intervals of the traces do not add up to
+ *    one for the total, so it has none
  */
 static void printresults(int n, stats_t *stats) 
 {
@@ -926,17 +2610,22 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%7s%22s%10s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "mad",
+	   "95% conf secs", "runs");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f%6.1f%%  %9.6f-%9.6f %9d\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].timing.mad/stats[i].secs*100.0,
+		   stats[i].timing.lo,
+		   stats[i].timing.hi,
+		   stats[i].timing.runs);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -972,6 +2661,91 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printmmstats - prints the final heap and mapped sizes of the mm
+ *    package in each utilization run and their peak sum, along with its
+ *    allocator counters if it provides them
+ */
+static void printmmstats(int n, stats_t *stats)
+{
+    int i;
+    int counters = (mm_get_stats != NULL);
+    unsigned long hits = 0, misses = 0;
+    unsigned long thits = 0, tmisses = 0;
+
+    printf("\nHeap and allocator counters:\n");
+    printf("%5s%10s%10s%10s", "trace", "heap KB", "map KB", "peak KB");
+    if (counters)
+	printf("%10s%10s%6s%10s%10s%6s", "qhits", "qmisses", "qhit",
+	       "thits", "tmisses", "thit");
+    printf("\n");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%13s%10s%10s", i, "-", "-", "-");
+	    if (counters)
+		printf("%10s%10s%6s%10s%10s%6s", "-", "-", "-", "-", "-", "-");
+	    printf("\n");
+	    continue;
+	}
+	printf("%2d%13.1f%10.1f%10.1f", i, stats[i].heap/1024.0,
+	       stats[i].mapped/1024.0, stats[i].peak/1024.0);
+	if (counters) {
+	    printf("%10lu%10lu%5.0f%%",
+		   stats[i].mm.quick_hits,
+		   stats[i].mm.quick_misses,
+		   percent(stats[i].mm.quick_hits,
+			   stats[i].mm.quick_hits + stats[i].mm.quick_misses));
+	    printf("%10lu%10lu%5.0f%%",
+		   stats[i].mm.tcache_hits,
+		   stats[i].mm.tcache_misses,
+		   percent(stats[i].mm.tcache_hits,
+			   stats[i].mm.tcache_hits + stats[i].mm.tcache_misses));
+	    hits += stats[i].mm.quick_hits;
+	    misses += stats[i].mm.quick_misses;
+	    thits += stats[i].mm.tcache_hits;
+	    tmisses += stats[i].mm.tcache_misses;
+	}
+	printf("\n");
+    }
+    if (counters)
+	printf("%5s%30s%10lu%10lu%5.0f%%%10lu%10lu%5.0f%%\n", "Total", "",
+	       hits, misses, percent(hits, hits + misses),
+	       thits, tmisses, percent(thits, thits + tmisses));
+}
+
+/*
+ * percent - part as a percentage of whole, 0 when whole is 0
+ */
+static double percent(unsigned long part, unsigned long whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+/*
+ * parse_size - parse a byte count with an optional K, M or G suffix,
+ *    returning 0 if it is malformed
+ */
+static size_t parse_size(char *arg)
+{
+    char *end;
+    unsigned long long size = strtoull(arg, &end, 0);
+
+    switch (*end) {
+    case 'G': case 'g':
+	size <<= 10;
+	/* fall through */
+    case 'M': case 'm':
+	size <<= 10;
+	/* fall through */
+    case 'K': case 'k':
+	size <<= 10;
+	end++;
+    }
+    if (end == arg || *end != '\0')
+	return 0;
+    return (size_t)size;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -993,10 +2767,10 @@ void unix_error(char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(int tracenum, long opnum, char *msg)
 {
-    errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+    printf("ERROR [trace %d, line %ld]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
 /* 
@@ -1004,14 +2778,31 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValOP] [-f <file>] [-t <dir>] [-B <file>] [-H <size>]\n");
+    fprintf(stderr, "               [-L small|thp|hugetlb|auto] [-M <threads>] [-Q <pairs>]\n");
+    fprintf(stderr, "               [-T <threads> [-SW]] [-C <slots>] [-R <ops>]\n");
+    fprintf(stderr, "               [-c fcyc|itimer|gettod|monotonic]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B <file>  Write the -f trace to <file> as a binary trace, read in place.\n");
+    fprintf(stderr, "\t-c <timer> Time with fcyc, itimer, gettod or monotonic (default from config.h).\n");
+    fprintf(stderr, "\t-C <n>     Cache up to <n> small blocks per size class in each mm thread (0 = off).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <size>  Heap size in bytes, with an optional K, M or G suffix, up to 4G.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L <pages> Back the heap with small, thp or hugetlb pages, or the best of them (auto).\n");
+    fprintf(stderr, "\t-M <n>     Compare mm throughput with 1 to <n> threads: global lock, per-class locks, arenas.\n");
+    fprintf(stderr, "\t-O         Report percentiles of the latency of each type of mm request.\n");
+    fprintf(stderr, "\t-P         Compare the mm free-list policies.\n");
+    fprintf(stderr, "\t-Q <n>     Compare mm throughput of 1 to <n> producer/consumer thread pairs.\n");
+    fprintf(stderr, "\t-R <n>     Stream each trace <n> requests at a time and report each window.\n");
+    fprintf(stderr, "\t-S         With -T, split the block ids of each trace among the threads.\n");
+    fprintf(stderr, "\t-T <n>     Replay each trace on <n> threads, each on its own copy or its\n");
+    fprintf(stderr, "\t           own share of the threads of a v2 trace.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
-    fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
+    fprintf(stderr, "\t-v         Print per-trace performance breakdowns and allocator counters.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-W         With -T, keep to the timestamps of v2 traces.\n");
 }
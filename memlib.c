@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE     /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +11,223 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* Pages are committed in steps of at least this many bytes */
+#define MEM_COMMIT_STEP (64*1024)
+
+/* Size of the huge pages a huge-page backed heap is aligned to */
+#define MEM_HUGE_PAGE (2*1024*1024)
+
+/* One simulated heap: a reserved range whose pages are committed as
+   its brk moves up */
+struct mem_heap {
+    char *start_brk;   /* points to first byte of heap */
+    char *brk;         /* points to last byte of heap */
+    char *max_addr;    /* largest legal heap address */ 
+    char *peak_brk;    /* highest brk since the last reset */
+    char *commit_brk;  /* end of the readable and writable pages */
+    size_t step;       /* commit step, a multiple of unit */
+    size_t unit;       /* granularity for handing pages back */
+    int backing;       /* MEM_BACKING_xxx the heap got */
+    struct mem_heap *next; /* next heap from mem_heap_create */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_heap_t mem_default;     /* the heap behind mem_sbrk and friends */
+static mem_heap_t *mem_heaps;      /* all live heaps from mem_heap_create */
+static char *mem_backing_names[MEM_BACKINGS] = {
+    "small", "thp", "hugetlb", "auto"
+};
+
+/* Regions handed out by mem_map, outside the simulated heap */
+typedef struct mem_region {
+    char *lo;                 /* first byte of the region */
+    size_t size;              /* region size in bytes, a page multiple */
+    struct mem_region *next;
+} mem_region_t;
+
+static mem_region_t *mem_regions;  /* all live mapped regions */
+static size_t mem_mapped;          /* bytes in mapped regions */
+static size_t mem_total;           /* bytes in all heaps and mapped regions */
+static size_t mem_peak_total;      /* largest mem_total since reset */
+
+/* Mapped regions may come and go from several threads; the region and
+   heap lists and mem_mapped are kept under mem_lock, the totals are
+   atomic. A heap is left to its one user to lock */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int heap_init(mem_heap_t *heap, size_t max_heap, int backing);
+static mem_region_t **find_region(void *lo);
+static char *reserve_hugetlb(size_t size);
+static char *reserve_thp(size_t size);
+static void update_total(ssize_t incr);
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model with a MAX_HEAP heap
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_init_size(MAX_HEAP, MEM_BACKING_SMALL);
+}
+
+/*
+ * mem_init_size - initialize the memory system model with a default
+ *    heap of up to max_heap bytes, backed as asked by one of the
+ *    MEM_BACKING_xxx constants (see mem_heap_create)
+ */
+void mem_init_size(size_t max_heap, int backing)
+{
+    if (heap_init(&mem_default, max_heap, backing) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+}
+
+/*
+ * mem_heap_create - make a new heap of up to max_heap bytes, backed as
+ *    asked by one of the MEM_BACKING_xxx constants. A huge-page backing
+ *    that is not available falls back to transparent huge pages (for
+ *    auto) and then to small pages; mem_backing_h tells which one was
+ *    used. Returns NULL if the heap cannot be reserved.
+ */
+mem_heap_t *mem_heap_create(size_t max_heap, int backing)
+{
+    mem_heap_t *heap;
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    if ((heap = (mem_heap_t *)malloc(sizeof(mem_heap_t))) == NULL)
+	return NULL;
+    if (heap_init(heap, max_heap, backing) < 0) {
+	free(heap);
+	return NULL;
+    }
+    pthread_mutex_lock(&mem_lock);
+    heap->next = mem_heaps;
+    mem_heaps = heap;
+    pthread_mutex_unlock(&mem_lock);
+    return heap;
+}
+
+/*
+ * mem_heap_destroy - release a heap from mem_heap_create
+ */
+void mem_heap_destroy(mem_heap_t *heap)
+{
+    mem_heap_t **hp;
+
+    pthread_mutex_lock(&mem_lock);
+    for (hp = &mem_heaps; *hp != NULL && *hp != heap; hp = &(*hp)->next)
+	;
+    if (*hp == NULL) {
+	pthread_mutex_unlock(&mem_lock);
+	return;
+    }
+    *hp = heap->next;
+    pthread_mutex_unlock(&mem_lock);
+    update_total(-(ssize_t)mem_heapsize_h(heap));
+    munmap(heap->start_brk, heap->max_addr - heap->start_brk);
+    free(heap);
+}
+
+/*
+ * heap_init - reserve the range of a heap. The range is only reserved
+ *    here; mem_sbrk_h commits pages as the heap grows into it.
+ */
+static int heap_init(mem_heap_t *heap, size_t max_heap, int backing)
+{
+    size_t align = (backing == MEM_BACKING_SMALL) ? mem_pagesize() : MEM_HUGE_PAGE;
+    char *start = NULL;
+
+    max_heap = (max_heap + align - 1) & ~(align - 1);
+    heap->unit = mem_pagesize();
+
+    if (backing == MEM_BACKING_HUGETLB || backing == MEM_BACKING_AUTO) {
+	if ((start = reserve_hugetlb(max_heap)) != NULL) {
+	    heap->backing = MEM_BACKING_HUGETLB;
+	    heap->unit = MEM_HUGE_PAGE;
+	}
+    }
+    if (start == NULL &&
+	(backing == MEM_BACKING_THP || backing == MEM_BACKING_AUTO)) {
+	if ((start = reserve_thp(max_heap)) != NULL)
+	    heap->backing = MEM_BACKING_THP;
+    }
+
+    /* reserve the address space we will use to model the available VM */
+    if (start == NULL) {
+	start = mmap(NULL, max_heap, PROT_NONE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (start == MAP_FAILED)
+	    return -1;
+	heap->backing = MEM_BACKING_SMALL;
+    }
+
+    /* Commit whole huge pages so they can back the heap */
+    heap->step = (heap->backing == MEM_BACKING_SMALL) ? MEM_COMMIT_STEP : MEM_HUGE_PAGE;
+
+    heap->start_brk = start;
+    heap->max_addr = start + max_heap;  /* max legal heap address */
+    heap->brk = start;                  /* heap is empty initially */
+    heap->peak_brk = start;
+    heap->commit_brk = start;           /* nothing committed yet */
+    return 0;
+}
+
+/*
+ * reserve_hugetlb - reserve size bytes of explicit huge pages, or return
+ *    NULL if the huge page pool cannot supply them. The pages are taken
+ *    from the pool now, so later faults cannot fail.
+ */
+static char *reserve_hugetlb(size_t size)
+{
+#ifdef MAP_HUGETLB
+    char *lo = mmap(NULL, size, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (lo != MAP_FAILED)
+	return lo;
+#endif
+    return NULL;
+}
+
+/*
+ * reserve_thp - reserve size bytes aligned to a huge page and ask for
+ *    transparent huge pages on them, or return NULL if the kernel has
+ *    them disabled
+ */
+static char *reserve_thp(size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    char buf[128];
+    FILE *f;
+    char *base, *lo;
+
+    /* madvise succeeds even when THP is off, so ask the kernel first */
+    if ((f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r")) == NULL)
+	return NULL;
+    if (fgets(buf, sizeof(buf), f) == NULL || strstr(buf, "[never]") != NULL) {
+	fclose(f);
+	return NULL;
+    }
+    fclose(f);
+
+    /* Over-reserve by a huge page and trim to an aligned range */
+    base = mmap(NULL, size + MEM_HUGE_PAGE, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+	return NULL;
+    lo = (char *)(((size_t)base + MEM_HUGE_PAGE - 1) & ~(size_t)(MEM_HUGE_PAGE - 1));
+    if (lo > base)
+	munmap(base, lo - base);
+    munmap(lo + size, base + MEM_HUGE_PAGE - lo);
+    if (madvise(lo, size, MADV_HUGEPAGE) == 0)
+	return lo;
+    munmap(lo, size);
+#endif
+    return NULL;
 }
 
 /* 
@@ -39,57 +235,380 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_default.start_brk, mem_default.max_addr - mem_default.start_brk);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make the default
+ *    heap and every heap from mem_heap_create empty, and unmap any
+ *    regions left mapped
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_region_t *r;
+    mem_heap_t *heap;
+
+    while ((r = mem_regions) != NULL) {
+	mem_regions = r->next;
+	munmap(r->lo, r->size);
+	free(r);
+    }
+    update_total(-(ssize_t)mem_mapped);
+    mem_mapped = 0;
+    mem_reset_brk_h(&mem_default);
+    pthread_mutex_lock(&mem_lock);
+    for (heap = mem_heaps; heap != NULL; heap = heap->next)
+	mem_reset_brk_h(heap);
+    pthread_mutex_unlock(&mem_lock);
+    mem_peak_total = mem_total;
+}
+
+/*
+ * mem_reset_brk_h - empty a heap
+ */
+void mem_reset_brk_h(mem_heap_t *heap)
+{
+    update_total(-(ssize_t)mem_heapsize_h(heap));
+    heap->brk = heap->start_brk;
+    heap->peak_brk = heap->start_brk;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ * mem_sbrk - simple model of the sbrk function on the default heap
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(ssize_t incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_sbrk_h(&mem_default, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+/* 
+ * mem_sbrk_h - simple model of the sbrk function. Extends the heap 
+ *    by incr bytes and returns the start address of the new area,
+ *    committing the pages it grows into. A negative incr shrinks the
+ *    heap, and the whole pages above the new brk are handed back to
+ *    the system.
+ */
+void *mem_sbrk_h(mem_heap_t *heap, ssize_t incr) 
+{
+    char *old_brk = heap->brk;
+    char *lo, *hi;
+
+    if (incr < 0 && (size_t)-incr > (size_t)(heap->brk - heap->start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap start...\n");
+	return (void *)-1;
+    }
+    if (incr > 0 && (size_t)incr > (size_t)(heap->max_addr - heap->brk)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+
+    /* Commit the pages the heap grows into */
+    if (heap->brk + incr > heap->commit_brk) {
+	hi = heap->brk + incr + heap->step - 1;
+	hi -= (size_t)(hi - heap->start_brk) % heap->step;
+	if (hi > heap->max_addr)
+	    hi = heap->max_addr;
+	if (mprotect(heap->commit_brk, hi - heap->commit_brk,
+		     PROT_READ | PROT_WRITE) < 0) {
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	    return (void *)-1;
+	}
+	heap->commit_brk = hi;
+    }
+
+    heap->brk += incr;
+    if (heap->brk > heap->peak_brk)
+	heap->peak_brk = heap->brk;
+    update_total(incr);
+
+    /* Drop the pages released by a shrink; they read back as zeros */
+    if (incr < 0) {
+	lo = (char *)(((size_t)heap->brk + heap->unit - 1) & ~(heap->unit - 1));
+	hi = (char *)((size_t)old_brk & ~(heap->unit - 1));
+	if (lo < hi)
+	    madvise(lo, hi - lo, MADV_DONTNEED);
+    }
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_map - map a fresh region of at least size bytes, rounded up to
+ *    whole pages, outside the heap. Returns NULL when out of memory.
+ */
+void *mem_map(size_t size)
+{
+    mem_region_t *r;
+    char *lo;
+
+    size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    lo = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lo == MAP_FAILED) {
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return NULL;
+    }
+    if ((r = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL) {
+	munmap(lo, size);
+	return NULL;
+    }
+    r->lo = lo;
+    r->size = size;
+    pthread_mutex_lock(&mem_lock);
+    r->next = mem_regions;
+    mem_regions = r;
+    mem_mapped += size;
+    pthread_mutex_unlock(&mem_lock);
+    update_total(size);
+    return (void *)lo;
+}
+
+/*
+ * mem_remap - resize the region at ptr, from mem_map, to at least size
+ *    bytes, moving it if need be. Returns the new start, or NULL with the
+ *    region left as it was.
+ */
+void *mem_remap(void *ptr, size_t size)
+{
+    mem_region_t **rp;
+    mem_region_t *r;
+    size_t old_size;
+    char *lo;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((rp = find_region(ptr)) == NULL) {
+	pthread_mutex_unlock(&mem_lock);
+	fprintf(stderr, "ERROR: mem_remap of %p, which is not mapped\n", ptr);
+	return NULL;
+    }
+    r = *rp;
+    size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    lo = mremap(r->lo, r->size, size, MREMAP_MAYMOVE);
+    if (lo == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_lock);
+	fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+	return NULL;
+    }
+    old_size = r->size;
+    mem_mapped += size - old_size;
+    r->lo = lo;
+    r->size = size;
+    pthread_mutex_unlock(&mem_lock);
+    update_total(size - old_size);
+    return (void *)lo;
+}
+
+/*
+ * mem_unmap - release the region at ptr, from mem_map
+ */
+void mem_unmap(void *ptr)
+{
+    mem_region_t **rp;
+    mem_region_t *r;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((rp = find_region(ptr)) == NULL) {
+	pthread_mutex_unlock(&mem_lock);
+	fprintf(stderr, "ERROR: mem_unmap of %p, which is not mapped\n", ptr);
+	return;
+    }
+    r = *rp;
+    *rp = r->next;
+    mem_mapped -= r->size;
+    pthread_mutex_unlock(&mem_lock);
+    munmap(r->lo, r->size);
+    update_total(-(ssize_t)r->size);
+    free(r);
+}
+
+/*
+ * mem_is_mapped - true if the bytes lo..lo+size-1 lie in one mapped region
+ */
+int mem_is_mapped(void *lo, size_t size)
+{
+    mem_region_t *r;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_lock);
+    for (r = mem_regions; r != NULL && !found; r = r->next)
+	if ((char *)lo >= r->lo && (char *)lo + size <= r->lo + r->size)
+	    found = 1;
+    pthread_mutex_unlock(&mem_lock);
+    return found;
+}
+
+/*
+ * mem_is_heap - true if the bytes lo..lo+size-1 lie below the brk of the
+ *    default heap or of one from mem_heap_create
+ */
+int mem_is_heap(void *lo, size_t size)
+{
+    mem_heap_t *heap;
+    int found = ((char *)lo >= mem_default.start_brk &&
+		 (char *)lo + size <= mem_default.brk);
+
+    pthread_mutex_lock(&mem_lock);
+    for (heap = mem_heaps; heap != NULL && !found; heap = heap->next)
+	if ((char *)lo >= heap->start_brk && (char *)lo + size <= heap->brk)
+	    found = 1;
+    pthread_mutex_unlock(&mem_lock);
+    return found;
+}
+
+/*
+ * find_region - return the link pointing at the region starting at lo,
+ *    or NULL if there is none; mem_lock is held
+ */
+static mem_region_t **find_region(void *lo)
+{
+    mem_region_t **rp;
+
+    for (rp = &mem_regions; *rp != NULL; rp = &(*rp)->next)
+	if ((*rp)->lo == (char *)lo)
+	    return rp;
+    return NULL;
+}
+
+/*
+ * update_total - add incr bytes to the total in heaps and mapped
+ *    regions, and fold it into the peak
+ */
+static void update_total(ssize_t incr)
+{
+    size_t total = __atomic_add_fetch(&mem_total, incr, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&mem_peak_total, __ATOMIC_RELAXED);
+
+    while (total > peak &&
+	   !__atomic_compare_exchange_n(&mem_peak_total, &peak, total, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * mem_heap_lo - return address of the first byte of the default heap
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_heap_lo_h(&mem_default);
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last byte of the default heap
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_heap_hi_h(&mem_default);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the default heap size in bytes
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_heapsize_h(&mem_default);
+}
+
+/*
+ * mem_heap_peak() - returns the largest default heap size in bytes
+ *    since the last reset
+ */
+size_t mem_heap_peak()
+{
+    return mem_heap_peak_h(&mem_default);
+}
+
+/*
+ * mem_heap_lo_h - return address of the first heap byte
+ */
+void *mem_heap_lo_h(mem_heap_t *heap)
+{
+    return (void *)heap->start_brk;
+}
+
+/* 
+ * mem_heap_hi_h - return address of last heap byte
+ */
+void *mem_heap_hi_h(mem_heap_t *heap)
+{
+    return (void *)(heap->brk - 1);
+}
+
+/*
+ * mem_heap_max_h - return address of the last byte the heap may grow to
+ */
+void *mem_heap_max_h(mem_heap_t *heap)
+{
+    return (void *)(heap->max_addr - 1);
+}
+
+/*
+ * mem_heapsize_h() - returns the heap size in bytes
+ */
+size_t mem_heapsize_h(mem_heap_t *heap) 
+{
+    return (size_t)(heap->brk - heap->start_brk);
+}
+
+/*
+ * mem_heap_peak_h() - returns the largest heap size in bytes since the
+ *    last reset
+ */
+size_t mem_heap_peak_h(mem_heap_t *heap)
+{
+    return (size_t)(heap->peak_brk - heap->start_brk);
+}
+
+/*
+ * mem_default_heap() - returns the heap behind mem_sbrk
+ */
+mem_heap_t *mem_default_heap()
+{
+    return &mem_default;
+}
+
+/*
+ * mem_mapsize() - returns the bytes currently in mapped regions
+ */
+size_t mem_mapsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_footprint_peak() - returns the largest size of all heaps plus
+ *    mapped regions in bytes since the last reset
+ */
+size_t mem_footprint_peak()
+{
+    return mem_peak_total;
+}
+
+/*
+ * mem_backing() - returns the MEM_BACKING_xxx constant of the pages
+ *    backing the default heap
+ */
+int mem_backing()
+{
+    return mem_backing_h(&mem_default);
+}
+
+/*
+ * mem_backing_h() - returns the MEM_BACKING_xxx constant of the pages
+ *    backing a heap
+ */
+int mem_backing_h(mem_heap_t *heap)
+{
+    return heap->backing;
+}
+
+/*
+ * mem_backing_name() - returns the name of a MEM_BACKING_xxx constant
+ */
+char *mem_backing_name(int backing)
+{
+    return mem_backing_names[backing];
 }
 
 /*
@@ -1,11 +1,52 @@
 #include <unistd.h>
 
+/*
+ * Pages backing a heap, for mem_init_size and mem_heap_create. The huge
+ * page backings align the heap to a 2 MB huge page and fall back to
+ * small pages when the system does not provide them.
+ */
+#define MEM_BACKING_SMALL   0   /* base pages */
+#define MEM_BACKING_THP     1   /* transparent huge pages, MADV_HUGEPAGE */
+#define MEM_BACKING_HUGETLB 2   /* explicit huge pages, MAP_HUGETLB */
+#define MEM_BACKING_AUTO    3   /* hugetlb, else thp, else small */
+#define MEM_BACKINGS        4
+
+/* The default heap, used by mm.c and mdriver */
 void mem_init(void);               
+void mem_init_size(size_t max_heap, int backing);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(ssize_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
-size_t mem_pagesize(void);
+size_t mem_heap_peak(void);
+int mem_backing(void);
+
+/* Independent heaps, each with its own brk */
+typedef struct mem_heap mem_heap_t;
 
+mem_heap_t *mem_heap_create(size_t max_heap, int backing);
+void mem_heap_destroy(mem_heap_t *heap);
+mem_heap_t *mem_default_heap(void);
+void *mem_sbrk_h(mem_heap_t *heap, ssize_t incr);
+void mem_reset_brk_h(mem_heap_t *heap);
+void *mem_heap_lo_h(mem_heap_t *heap);
+void *mem_heap_hi_h(mem_heap_t *heap);
+void *mem_heap_max_h(mem_heap_t *heap);
+size_t mem_heapsize_h(mem_heap_t *heap);
+size_t mem_heap_peak_h(mem_heap_t *heap);
+int mem_backing_h(mem_heap_t *heap);
+int mem_is_heap(void *lo, size_t size);
+
+/* Page-granular regions outside the heaps */
+void *mem_map(size_t size);
+void *mem_remap(void *ptr, size_t size);
+void mem_unmap(void *ptr);
+int mem_is_mapped(void *lo, size_t size);
+size_t mem_mapsize(void);
+
+/* All heaps plus mapped regions, and the system */
+size_t mem_footprint_peak(void);
+char *mem_backing_name(int backing);
+size_t mem_pagesize(void);
@@ -8,6 +8,7 @@
 #include "memlib.h"
 
 /*Private glovbal variables*/
+static char* heap_base = NULL;
 static char* heap_listp = NULL;
 static char* root = NULL;
 static void* extend_heap(size_t words);
@@ -44,6 +45,11 @@ team_t team = {
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 
+/* Read and write a free-list link, stored as a 32-bit offset from the
+ * heap start in DSIZE units so 64-bit pointers still fit in one word */
+#define GET_PTR(p) (GET(p) ? heap_base + ((size_t)GET(p) * DSIZE) : NULL)
+#define PUT_PTR(p, ptr) PUT(p, (ptr) ? (unsigned int)(((char *)(ptr) - heap_base) / DSIZE) : 0)
+
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
@@ -54,7 +60,7 @@ team_t team = {
 
 /* Given block ptr bp, compute prev and next free block ptr*/
 #define DOWN_FREE_BLKP(bp) ((char*)(bp))
-#define ABOV_FREE_BLKP(bp) ((char*)(bp+WSIZE))
+#define ABOV_FREE_BLKP(bp) ((char*)(bp) + WSIZE)
 
 /* Given block ptr bp, compute address of next and previous blocks */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
@@ -77,6 +83,7 @@ team_t team = {
  */
 int mm_init(void)
 {
+    heap_base = mem_heap_lo();
     if((heap_listp = mem_sbrk(6*WSIZE))==(void *)-1){
         return -1;
     }
@@ -100,11 +107,11 @@ int mm_init(void)
  * */
 static void insert(char* bp)
 {
-    char* nextp = GET(root);
+    char* nextp = GET_PTR(root);
     if(nextp != NULL)
-        PUT(ABOV_FREE_BLKP(nextp), bp);
-    PUT(DOWN_FREE_BLKP(bp), nextp);
-    PUT(root, bp);
+        PUT_PTR(ABOV_FREE_BLKP(nextp), bp);
+    PUT_PTR(DOWN_FREE_BLKP(bp), nextp);
+    PUT_PTR(root, bp);
 }
 
 /*
@@ -113,22 +120,22 @@ static void insert(char* bp)
  * */
 static void delete(char* bp)
 {
-    char* abov = GET(ABOV_FREE_BLKP(bp));
-    char* down = GET(DOWN_FREE_BLKP(bp));
+    char* abov = GET_PTR(ABOV_FREE_BLKP(bp));
+    char* down = GET_PTR(DOWN_FREE_BLKP(bp));
 
     if(abov == NULL) {
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), 0);
-        PUT(root, down);
+            PUT_PTR(ABOV_FREE_BLKP(down), NULL);
+        PUT_PTR(root, down);
     }
     else {
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), abov);
-        PUT(DOWN_FREE_BLKP(abov), down);
+            PUT_PTR(ABOV_FREE_BLKP(down), abov);
+        PUT_PTR(DOWN_FREE_BLKP(abov), down);
     }
 
-    PUT(DOWN_FREE_BLKP(bp), 0);
-    PUT(ABOV_FREE_BLKP(bp), 0);
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
 }
 
 /*
@@ -177,14 +184,14 @@ static void* extend_heap(size_t words)
 
     /*allocate an even number to maintain alignment*/
     size = (words%2)?(words+1)*DSIZE:words*DSIZE;
-    if((long)(bp = mem_sbrk(size)) ==(void*) -1)
+    if((bp = mem_sbrk(size)) == (void*)-1)
         return NULL;
 
     /*Initialize free block header/footer and the epilogue header*/
     PUT(HDRP(bp), PACK(size, 0));                /*Free block header*/
     PUT(FTRP(bp), PACK(size, 0));                /*Free block footer*/
-    PUT(DOWN_FREE_BLKP(bp), 0);                  /*Previous free block*/
-    PUT(ABOV_FREE_BLKP(bp), 0);                  /*Next free block*/
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);           /*Previous free block*/
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);           /*Next free block*/
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1));         /*New epilogue header*/
 
     return coalesce(bp);
@@ -197,12 +204,12 @@ static void* extend_heap(size_t words)
 static void* find_fit(size_t size)
 {
     /*First fit search*/
-    char* cur = GET(root);
+    char* cur = GET_PTR(root);
 
     while(cur != NULL) {
         if(GET_SIZE(HDRP(cur)) >= size)
             return cur;
-        cur = GET(DOWN_FREE_BLKP(cur));
+        cur = GET_PTR(DOWN_FREE_BLKP(cur));
     }
     return NULL;
 }
@@ -223,8 +230,8 @@ static void place(void* bp, size_t size)
         bp = NEXT_BLKP(bp);
         PUT(HDRP(bp), PACK(csize-size, 0));
         PUT(FTRP(bp), PACK(csize-size, 0));     /*whether should we return the older bp or not?*/
-        PUT(DOWN_FREE_BLKP(bp), 0);
-        PUT(ABOV_FREE_BLKP(bp), 0);
+        PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+        PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
         coalesce(bp);
     }
     else {
@@ -277,8 +284,8 @@ void mm_free(void *bp)
     size_t size = GET_SIZE(HDRP(bp));
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
-    PUT(DOWN_FREE_BLKP(bp), 0);
-    PUT(ABOV_FREE_BLKP(bp), 0);
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
     coalesce(bp);
 }
 
@@ -287,36 +294,13 @@ void mm_free(void *bp)
  */
 void *mm_realloc(void *ptr, size_t size)
 {
-    /*
     void *oldptr = ptr;
     void *newptr;
     size_t copySize;
 
-    newptr = mm_malloc(size);
-    if (newptr == NULL)
-      return NULL;
-
-    copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
-    if (size < copySize)
-      copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
-    return newptr;
-    */
-
-    //ptr is a block pointer
-    void* newptr;
-    size_t csize;
-    size_t newsize;
-
     //if ptr = NULL,it's equivalent to mm_malloc(size)
-    if(ptr == NULL) {
-        newptr = mm_malloc(size);
-        if(!newptr) {
-            return NULL;
-        }
-        return newptr;
-    }
+    if(ptr == NULL)
+        return mm_malloc(size);
 
     //if size = 0,it's equivalent to mm_free(ptr)
     if(size == 0) {
@@ -324,13 +308,14 @@ void *mm_realloc(void *ptr, size_t size)
         return NULL;
     }
 
-    //normal realloc
-    csize = GET_SIZE(HDRP(ptr));
-    newsize = ALIGN(size) + DSIZE;
-    newptr = ptr;
-    PUT(HDRP(newptr), PACK(newsize, 1));
-    PUT(HDRP(newptr), PACK(newsize, 1));
-    return newptr;
+    newptr = mm_malloc(size);
+    if (newptr == NULL)
+      return NULL;
 
+    copySize = GET_SIZE(HDRP(oldptr)) - DSIZE;
+    if (size < copySize)
+      copySize = size;
+    memcpy(newptr, oldptr, copySize);
+    mm_free(oldptr);
+    return newptr;
 }
-
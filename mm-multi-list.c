@@ -8,6 +8,7 @@
 #include "memlib.h"
 
 /*Private glovbal variables*/
+static char* heap_base = NULL;
 static char* heap_listp = NULL;
 static char* root = NULL;
 static char* block_list_start = NULL;
@@ -46,6 +47,11 @@ team_t team = {
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 
+/* Read and write a free-list link, stored as a 32-bit offset from the
+ * heap start in DSIZE units so 64-bit pointers still fit in one word */
+#define GET_PTR(p) (GET(p) ? heap_base + ((size_t)GET(p) * DSIZE) : NULL)
+#define PUT_PTR(p, ptr) PUT(p, (ptr) ? (unsigned int)(((char *)(ptr) - heap_base) / DSIZE) : 0)
+
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
@@ -56,7 +62,7 @@ team_t team = {
 
 /* Given block ptr bp, compute prev and next free block ptr*/
 #define DOWN_FREE_BLKP(bp) ((char*)(bp))
-#define ABOV_FREE_BLKP(bp) ((char*)(bp+WSIZE))
+#define ABOV_FREE_BLKP(bp) ((char*)(bp) + WSIZE)
 
 /* Given block ptr bp, compute address of next and previous blocks */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
@@ -79,6 +85,7 @@ team_t team = {
  */
 int mm_init(void)
 {
+    heap_base = mem_heap_lo();
     if((heap_listp = mem_sbrk(14*WSIZE))==(void *)-1){
         return -1;
     }
@@ -132,28 +139,28 @@ static char* find_list_root(size_t size)
 static void insert(char* bp)
 {
     char* root = find_list_root(GET_SIZE(HDRP(bp)));
-    char* down = GET(root);
+    char* down = GET_PTR(root);
     char* abov = root;
 
     while(down != NULL) {
         if(GET_SIZE(HDRP(down)) >= GET_SIZE(HDRP(bp)))
             break;
         abov = down;
-        down = GET(DOWN_FREE_BLKP(down));
+        down = GET_PTR(DOWN_FREE_BLKP(down));
     }
     if(abov == root) {
-        PUT(DOWN_FREE_BLKP(bp), down);
-        PUT(ABOV_FREE_BLKP(bp), NULL);
+        PUT_PTR(DOWN_FREE_BLKP(bp), down);
+        PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), bp);
-        PUT(root, bp);
+            PUT_PTR(ABOV_FREE_BLKP(down), bp);
+        PUT_PTR(root, bp);
     }
     else {
-        PUT(DOWN_FREE_BLKP(abov), bp);
-        PUT(ABOV_FREE_BLKP(bp), abov);
-        PUT(DOWN_FREE_BLKP(bp), down);
+        PUT_PTR(DOWN_FREE_BLKP(abov), bp);
+        PUT_PTR(ABOV_FREE_BLKP(bp), abov);
+        PUT_PTR(DOWN_FREE_BLKP(bp), down);
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), bp);
+            PUT_PTR(ABOV_FREE_BLKP(down), bp);
     }
 }
 
@@ -164,22 +171,22 @@ static void insert(char* bp)
 static void delete(char* bp)
 {
     char* root = find_list_root(GET_SIZE(HDRP(bp)));
-    char* abov = GET(ABOV_FREE_BLKP(bp));
-    char* down = GET(DOWN_FREE_BLKP(bp));
+    char* abov = GET_PTR(ABOV_FREE_BLKP(bp));
+    char* down = GET_PTR(DOWN_FREE_BLKP(bp));
 
     if(abov == NULL) {
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), 0);
-        PUT(root, down);
+            PUT_PTR(ABOV_FREE_BLKP(down), NULL);
+        PUT_PTR(root, down);
     }
     else {
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), abov);
-        PUT(DOWN_FREE_BLKP(abov), down);
+            PUT_PTR(ABOV_FREE_BLKP(down), abov);
+        PUT_PTR(DOWN_FREE_BLKP(abov), down);
     }
 
-    PUT(DOWN_FREE_BLKP(bp), 0);
-    PUT(ABOV_FREE_BLKP(bp), 0);
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
 }
 
 /*
@@ -197,8 +204,7 @@ static void* coalesce(void* bp)
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         delete(NEXT_BLKP(bp));
         PUT(HDRP(bp), PACK(size, 0));
-        //PUT(FTRP(bp), PACK(size, 0));               //right?
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
     }
     else if(!prev_alloc && next_alloc) {
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
@@ -229,14 +235,14 @@ static void* extend_heap(size_t words)
 
     /*allocate an even number to maintain alignment*/
     size = (words%2)?(words+1)*DSIZE:words*DSIZE;
-    if((long)(bp = mem_sbrk(size)) ==(void*) -1)
+    if((bp = mem_sbrk(size)) == (void*)-1)
         return NULL;
 
     /*Initialize free block header/footer and the epilogue header*/
     PUT(HDRP(bp), PACK(size, 0));                /*Free block header*/
     PUT(FTRP(bp), PACK(size, 0));                /*Free block footer*/
-    PUT(DOWN_FREE_BLKP(bp), 0);                  /*Previous free block*/
-    PUT(ABOV_FREE_BLKP(bp), 0);                  /*Next free block*/
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);           /*Previous free block*/
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);           /*Next free block*/
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1));         /*New epilogue header*/
 
     return coalesce(bp);
@@ -253,11 +259,11 @@ static void* find_fit(size_t size)
     char* cur;
 
     for(root;root != heap_listp-2*WSIZE;root += WSIZE) {
-        cur = (char*)GET(root);
+        cur = GET_PTR(root);
         while(cur != NULL) {
             if(GET_SIZE(HDRP(cur)) >= size)
                 return cur;
-            cur = GET(DOWN_FREE_BLKP(cur));
+            cur = GET_PTR(DOWN_FREE_BLKP(cur));
         }
     }
     return NULL;
@@ -280,8 +286,8 @@ static void place(void* bp, size_t size)
         tmp = NEXT_BLKP(bp);
         PUT(HDRP(tmp), PACK(csize-size, 0));
         PUT(FTRP(tmp), PACK(csize-size, 0));
-        PUT(DOWN_FREE_BLKP(tmp), 0);
-        PUT(ABOV_FREE_BLKP(tmp), 0);
+        PUT_PTR(DOWN_FREE_BLKP(tmp), NULL);
+        PUT_PTR(ABOV_FREE_BLKP(tmp), NULL);
         coalesce(tmp);
     }
     else {
@@ -334,8 +340,8 @@ void mm_free(void *bp)
     size_t size = GET_SIZE(HDRP(bp));
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
-    PUT(DOWN_FREE_BLKP(bp), 0);
-    PUT(ABOV_FREE_BLKP(bp), 0);
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
     coalesce(bp);
 }
 
@@ -344,36 +350,13 @@ void mm_free(void *bp)
  */
 void *mm_realloc(void *ptr, size_t size)
 {
-    /*
     void *oldptr = ptr;
     void *newptr;
     size_t copySize;
 
-    newptr = mm_malloc(size);
-    if (newptr == NULL)
-      return NULL;
-
-    copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
-    if (size < copySize)
-      copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
-    return newptr;
-    */
-
-    //ptr is a block pointer
-    void* newptr;
-    size_t csize;
-    size_t newsize;
-
     //if ptr = NULL,it's equivalent to mm_malloc(size)
-    if(ptr == NULL) {
-        newptr = mm_malloc(size);
-        if(!newptr) {
-            return NULL;
-        }
-        return newptr;
-    }
+    if(ptr == NULL)
+        return mm_malloc(size);
 
     //if size = 0,it's equivalent to mm_free(ptr)
     if(size == 0) {
@@ -381,13 +364,14 @@ void *mm_realloc(void *ptr, size_t size)
         return NULL;
     }
 
-    //normal realloc
-    csize = GET_SIZE(HDRP(ptr));
-    newsize = ALIGN(size) + DSIZE;
-    newptr = ptr;
-    PUT(HDRP(newptr), PACK(newsize, 1));
-    PUT(HDRP(newptr), PACK(newsize, 1));
-    return newptr;
+    newptr = mm_malloc(size);
+    if (newptr == NULL)
+      return NULL;
 
+    copySize = GET_SIZE(HDRP(oldptr)) - DSIZE;
+    if (size < copySize)
+      copySize = size;
+    memcpy(newptr, oldptr, copySize);
+    mm_free(oldptr);
+    return newptr;
 }
-
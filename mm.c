@@ -1,3 +1,6 @@
+#ifdef MM_THREADS
+#define _GNU_SOURCE                 /*sched_getcpu*/
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -7,17 +10,73 @@
 #include "mm.h"
 #include "memlib.h"
 
+#ifdef MM_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 /*Private glovbal variables*/
-static char* heap_listp = NULL;
 static char* root = NULL;
-static char* block_list_start = NULL;
+typedef struct arena arena_t;
+typedef struct tcache tcache_t;
 static void* extend_heap(size_t size);
-static void* coalesce(void* bp);
+static char* release(char* bp, size_t keep);
 static void* find_fit(size_t size);
-static void place(void* bp, size_t size);
+static void take(char* bp);
+static int claim(char* bp, unsigned int hdr);
+static int grow_heap_end(char* ep, size_t size);
+static void set_header(char* bp, unsigned int val);
+static void lock_lists(unsigned int mask);
+static void unlock_lists(unsigned int mask);
+static int trim_heap(char* bp, size_t size);
+static void split(void* bp, size_t size);
+static void* place_high(void* bp, size_t size);
 static void insert(char* bp);
 static void delete(char* bp);
+static int find_index(size_t size);
 static char* find_list_root(size_t size);
+static void tree_insert(char* bp);
+static void tree_delete(char* bp);
+static char* tree_find(size_t size);
+static void* alloc_block(size_t asize);
+static void* alloc_aligned(size_t asize, size_t align);
+static void free_block(void* bp);
+static char* slab_page(void* ptr);
+static int slab_mark(char* page, int slab);
+static void slab_push(char* page, int c);
+static void slab_unlink(char* page, int c);
+static char* slab_new(int c);
+static void* slab_take(int c);
+static void* slab_alloc(int c);
+static int slab_put(char* page, void* ptr);
+static void slab_free(char* page, void* ptr);
+static void* find_or_extend(size_t asize);
+static void quick_push(char* bp, size_t size);
+static void* quick_pop(size_t size);
+static void quick_flush(size_t size);
+static void quick_release(char* bp);
+static int quick_flush_all(void);
+static void* allocate(size_t size);
+static void deallocate(void* bp);
+static void* reallocate(void* ptr, size_t size);
+static void* map_block(size_t asize);
+static void* map_realloc(void* ptr, size_t size);
+static int arena_init(arena_t* a, mem_heap_t* heap);
+static void tcache_reset(tcache_t* tc);
+static void tcache_count(tcache_t* tc);
+static void* tcache_alloc(int c);
+static void tcache_flush(tcache_t* tc, int c, int n);
+static void tcache_free(char* page, void* ptr);
+#ifdef MM_THREADS
+static void tcache_exit(void* arg);
+static void tcache_key_create(void);
+static int remote_arena(arena_t* a);
+static void remote_free(arena_t* a, char* bp);
+static void remote_drain(arena_t* a);
+#endif
+static void free_local(char* bp, int cache);
+static arena_t* home_arena(void);
+static arena_t* arena_of(void* ptr);
 
 team_t team = {
     /* Team name */
@@ -32,6 +91,14 @@ team_t team = {
     ""
 };
 
+/* Free-list ordering, one of the MM_POLICY_xxx constants in mm.h */
+#ifndef POLICY
+#define POLICY MM_POLICY_SIZE
+#endif
+
+static int policy = POLICY;                 /*set by mm_set_policy*/
+static int cur_policy = POLICY;             /*policy of the current heap*/
+
 /* Basic constants and macros */
 #define WSIZE 4     /* Word and header/footer size (bytes) */
 #define DSIZE 8     /* Double word size (bytes) */
@@ -39,29 +106,235 @@ team_t team = {
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 
+/* A free block of at least TRIM_THRESHOLD bytes ending the heap is given
+ * back to memlib when a free creates it */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (32*CHUNKSIZE)
+#endif
+
+/* Blocks of at least MMAP_THRESHOLD bytes get a mem_map region of their
+ * own outside the heap. The header sits DSIZE-WSIZE bytes in and holds
+ * the region size with the MAPPED bit set */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (32*CHUNKSIZE)
+#endif
+#define MAPPED 0x4
+
 /* Pack a size and allocated bit into  word */
 #define PACK(size, alloc) ((size) | (alloc))
 
-/* Read and write a word at address p */
+/* Header bit telling whether the previous block is allocated */
+#define PREV_ALLOC 0x2
+
+/* Read and write a word at address p, and update one in place. Built
+ * with MM_THREADS the words are accessed atomically: a header is shared
+ * with the owner of the block in front, which flips its prev bit */
+#ifdef MM_THREADS
+#define GET(p) __atomic_load_n((unsigned int *)(p), __ATOMIC_ACQUIRE)
+#define PUT(p, val) __atomic_store_n((unsigned int *)(p), (val), __ATOMIC_RELEASE)
+#define PUT_OR(p, val) __atomic_fetch_or((unsigned int *)(p), (val), __ATOMIC_ACQ_REL)
+#define PUT_AND(p, val) __atomic_fetch_and((unsigned int *)(p), (val), __ATOMIC_ACQ_REL)
+#define PUT_ADD(p, val) __atomic_fetch_add((unsigned int *)(p), (val), __ATOMIC_ACQ_REL)
+#else
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
+#define PUT_OR(p, val) PUT(p, GET(p) | (val))
+#define PUT_AND(p, val) PUT(p, GET(p) & (val))
+#define PUT_ADD(p, val) PUT(p, GET(p) + (val))
+#endif
+
+/* Read and write a free-list link, stored as a 32-bit offset from the
+ * heap start in DSIZE units so 64-bit pointers still fit in one word */
+#define GET_PTR(p) (GET(p) ? ar->base + ((size_t)GET(p) * DSIZE) : NULL)
+#define PUT_PTR(p, ptr) PUT(p, (ptr) ? (unsigned int)(((char *)(ptr) - ar->base) / DSIZE) : 0)
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_MAPPED(p) (GET(p) & MAPPED)
+
+/* Set or clear the prev-allocated bit in the header of block bp */
+#define SET_PREV_ALLOC(bp) PUT_OR(HDRP(bp), PREV_ALLOC)
+#define CLR_PREV_ALLOC(bp) PUT_AND(HDRP(bp), ~PREV_ALLOC)
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Given block ptr bp, compute address of its header and footer
+ * only free blocks carry a footer */
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
 /* Given block ptr bp, compute prev and next free block ptr*/
 #define DOWN_FREE_BLKP(bp) ((char*)(bp))
-#define ABOV_FREE_BLKP(bp) ((char*)(bp+WSIZE))
+#define ABOV_FREE_BLKP(bp) ((char*)(bp) + WSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks
+ * PREV_BLKP is only valid when the previous block is free */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Segregated free lists: LISTS heads followed by the non-empty bitmap */
+#define LISTS 10
+#define BITMAP (ar->lists + LISTS*WSIZE)
+
+/* The last list head roots a bitwise trie keyed by block size, which
+ * holds the large blocks. Equal sizes hang off a tree node on a list
+ * through the down/abov links; list members have no parent */
+#define TREE_ROOT (ar->lists + (LISTS-1)*WSIZE)
+#define CHILD_BLKP(bp, bit) ((char*)(bp) + (2+(bit))*WSIZE)
+#define PARENT_BLKP(bp) ((char*)(bp) + 4*WSIZE)
+
+/* Requests up to SLAB_MAX bytes are served from slab pages: SLAB_PAGE
+ * aligned blocks cut into equal slots with no per-slot header. A page
+ * starts with its list links, class, free count and free-slot bitmap */
+#define SLAB_PAGE 4096
+#define SLAB_MAX 64
+#define SLAB_CLASSES 6
+#define SLAB_MAPWORDS (SLAB_PAGE/256)   /*one bit per slot of the 8-byte class*/
+#define SLAB_HDR ALIGN((4 + SLAB_MAPWORDS)*WSIZE)
+#define SLAB_SLOTS(c) ((SLAB_PAGE - WSIZE - SLAB_HDR) / slab_size[c])
+
+#define SLAB_NEXT(pg) ((char*)(pg))
+#define SLAB_PREV(pg) ((char*)(pg) + WSIZE)
+#define SLAB_CLASS(pg) ((char*)(pg) + 2*WSIZE)
+#define SLAB_NFREE(pg) ((char*)(pg) + 3*WSIZE)
+#define SLAB_MAP(pg) ((char*)(pg) + 4*WSIZE)
+
+/* Per-class lists of slab pages with free slots follow the bitmap, then
+ * the pagemap block, one bit per SLAB_PAGE of heap set for slab pages,
+ * and the number of pages it covers */
+#define SLAB_ROOT(c) (BITMAP + (1+(c))*WSIZE)
+#define PAGEMAP SLAB_ROOT(SLAB_CLASSES)
+#define PAGEMAP_PAGES (PAGEMAP + WSIZE)
+#define PAGE_INDEX(pg) ((size_t)(pg)/SLAB_PAGE - (size_t)ar->base/SLAB_PAGE)
+
+/* Freed blocks of QUICK_MIN to QUICK_MAX bytes are parked unmerged on
+ * per-size quick lists, still marked allocated, and handed straight back
+ * to mallocs of the same size. A parked block holds the link to the next
+ * one and the length of the list from it down. The lists follow the
+ * pagemap words, then the number of parked blocks. A list growing past
+ * QUICK_LIMIT, or a failed fit, merges the parked blocks back */
+#define QUICK_MIN (SLAB_MAX + DSIZE)
+#define QUICK_MAX 512
+#define QUICKS ((QUICK_MAX - QUICK_MIN)/DSIZE + 1)
+#define QUICK_LIMIT 16
+#define QUICK_ROOT(size) (PAGEMAP_PAGES + (1 + ((size) - QUICK_MIN)/DSIZE)*WSIZE)
+#define QUICK_PARKED QUICK_ROOT(QUICK_MAX + DSIZE)
+#define QUICK_NEXT(bp) ((char*)(bp))
+#define QUICK_COUNT(bp) ((char*)(bp) + WSIZE)
+
+/* Words ahead of the prologue, rounded up to odd to keep payloads aligned */
+#define HEAD_WORDS ((LISTS + 1 + SLAB_CLASSES + 2 + QUICKS + 1) | 1)
+
+/* Built with MM_THREADS, each free list with the quick lists of its
+ * sizes, each slab class, the pagemap and the heap end have a lock of
+ * their own. They nest as slab class, then pagemap, then lists by
+ * ascending index, then heap end: slab_new carves a page by
+ * alloc_block under its class lock, and slab_mark grows the pagemap by
+ * alloc_block under the pagemap lock. A free block belongs to the lock
+ * of its list; an allocated block to the thread holding it, except for
+ * the prev bit of its header. In MM_LOCK_GLOBAL mode a single lock
+ * around every call replaces them */
+#ifdef MM_THREADS
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static int locking = MM_LOCK_CLASS;         /*set by mm_set_locking*/
+
+#define LOCK(m) do { if(locking == MM_LOCK_CLASS) pthread_mutex_lock(m); } while(0)
+#define UNLOCK(m) do { if(locking == MM_LOCK_CLASS) pthread_mutex_unlock(m); } while(0)
+#define GLOBAL_LOCK() do { if(locking == MM_LOCK_GLOBAL) pthread_mutex_lock(&global_lock); } while(0)
+#define GLOBAL_UNLOCK() do { if(locking == MM_LOCK_GLOBAL) pthread_mutex_unlock(&global_lock); } while(0)
+#define THREAD_LOCAL __thread
+#else
+#define LOCK(m)
+#define UNLOCK(m)
+#define GLOBAL_LOCK()
+#define GLOBAL_UNLOCK()
+#define THREAD_LOCAL
+#endif
+
+/* An arena is a heap of its own in a memlib heap of its own: the list
+ * heads, blocks, locks and counters. Arena 0 lives in the default heap.
+ * Threads malloc from their home arena, picked round-robin or by CPU,
+ * and free into the arena whose heap holds the block */
+#ifndef MM_ARENAS
+#define MM_ARENAS 16
+#endif
+
+struct arena {
+    mem_heap_t* heap;                       /*memlib heap the blocks live in*/
+    char* base;                             /*first heap byte*/
+    char* end;                              /*last byte the heap may reach*/
+    char* listp;                            /*prologue block*/
+    char* lists;                            /*list heads ahead of it*/
+    unsigned long quick_hits[LISTS];        /*mallocs served by a quick list*/
+    unsigned long quick_misses[LISTS];      /*quick-sized mallocs that missed*/
+#ifdef MM_THREADS
+    pthread_mutex_t list_lock[LISTS];
+    pthread_mutex_t slab_lock[SLAB_CLASSES];
+    pthread_mutex_t pagemap_lock;
+    pthread_mutex_t heap_lock;
+    unsigned long remote_frees;             /*blocks drained from remote*/
+    unsigned long remote_drains;            /*batches they came in*/
+    unsigned long long remote __attribute__((aligned(64)));  /*see remote_free*/
+#endif
+};
+
+static arena_t arenas[MM_ARENAS];
+static int narenas = 1;                     /*arenas of the current heap*/
+static int want_arenas = 1;                 /*set by mm_set_arenas*/
+#ifdef MM_THREADS
+static int assign = MM_ARENA_THREAD;        /*set by mm_set_arenas*/
+#endif
+static unsigned int next_arena = 0;         /*round-robin counter*/
+static unsigned int generation = 0;         /*bumped by mm_init*/
+static THREAD_LOCAL arena_t* ar;            /*arena of the current call*/
+static THREAD_LOCAL arena_t* home;          /*arena this thread mallocs from*/
+static THREAD_LOCAL unsigned int home_generation;
+
+#ifdef MM_THREADS
+/* Blocks freed by a thread that does not malloc from their arena go on
+ * the arena's remote list: a count in the high word and the top block
+ * as a PUT_PTR offset in the low word, each block holding the word that
+ * was on top before it. The list is drained whole on the next malloc
+ * from the arena, or by the free that fills it to REMOTE_MAX */
+#ifndef REMOTE_MAX
+#define REMOTE_MAX 1024
+#endif
+#define REMOTE_COUNT(w) ((w) >> 32)
+#define REMOTE_TOP(w) ((w) & 0xffffffffULL)
+
+static int remote_on = 1;                   /*remote lists of the current heap*/
+static int want_remote = 1;                 /*set by mm_set_remote*/
+#endif
+
+/* Freed slab slots are cached per thread and class on LIFO lists linked
+ * through their first word, which need no lock. A miss refills half the
+ * capacity from the slab pages under one lock; a full list flushes half
+ * back the same way. TCACHE_CAP is the default capacity per class */
+#ifndef TCACHE_CAP
+#define TCACHE_CAP 32
+#endif
+
+struct tcache {
+    char* head[SLAB_CLASSES];               /*cached slots of each class*/
+    unsigned int count[SLAB_CLASSES];
+    unsigned int generation;                /*mm_init the slots are from*/
+    unsigned long hits, misses;             /*not yet in the totals*/
+};
+
+static THREAD_LOCAL tcache_t tcache;
+static int tcache_cap = TCACHE_CAP;         /*capacity of the current heap*/
+static int want_tcache_cap = TCACHE_CAP;    /*set by mm_set_tcache*/
+static unsigned long tcache_hits;           /*totals of all threads*/
+static unsigned long tcache_misses;
+#ifdef MM_THREADS
+static pthread_key_t tcache_key;            /*flushes a cache at thread exit*/
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* Slot size of each slab class, and the class serving (size+7)/8 */
+static const unsigned int slab_size[SLAB_CLASSES] = {8, 16, 24, 32, 48, 64};
+static const int slab_class[SLAB_MAX/DSIZE + 1] = {0, 0, 1, 2, 3, 4, 4, 5, 5};
+
 /* DEBUG */
 #define DEBUG 0
 
@@ -71,6 +344,9 @@ team_t team = {
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
+/* release keeps nothing and leaves the heap end alone */
+#define NO_TRIM ((size_t)-1)
+
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
 /*
@@ -79,81 +355,192 @@ team_t team = {
  */
 int mm_init(void)
 {
-    if((heap_listp = mem_sbrk(14*WSIZE))==(void *)-1){
+    mem_heap_t* heap;
+    size_t size;
+    int i;
+
+    cur_policy = policy;
+    tcache_cap = want_tcache_cap;
+    tcache_hits = tcache_misses = 0;
+#ifdef MM_THREADS
+    remote_on = want_remote;
+#endif
+    narenas = want_arenas;
+    next_arena = 0;
+    generation++;
+    heap = mem_default_heap();
+    size = (char*)mem_heap_max_h(heap) - (char*)mem_heap_lo_h(heap) + 1;
+    for(i = 0; i < narenas; i++) {
+        /*the other arenas get heaps like the default one, kept for reuse*/
+        if(i > 0 && (heap = arenas[i].heap) != NULL)
+            mem_reset_brk_h(heap);
+        else if(i > 0 && (heap = mem_heap_create(size, mem_backing())) == NULL)
+            return -1;
+        if(arena_init(&arenas[i], heap) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * arena_init - lay out an empty heap in arena a, on the memlib heap heap
+ * */
+static int arena_init(arena_t* a, mem_heap_t* heap)
+{
+    char* bp;
+    int i;
+
+    ar = a;
+    ar->heap = heap;
+    ar->base = mem_heap_lo_h(heap);
+    ar->end = mem_heap_max_h(heap);
+    memset(ar->quick_hits, 0, sizeof(ar->quick_hits));
+    memset(ar->quick_misses, 0, sizeof(ar->quick_misses));
+#ifdef MM_THREADS
+    for(i = 0; i < LISTS; i++)
+        pthread_mutex_init(&ar->list_lock[i], NULL);
+    for(i = 0; i < SLAB_CLASSES; i++)
+        pthread_mutex_init(&ar->slab_lock[i], NULL);
+    pthread_mutex_init(&ar->pagemap_lock, NULL);
+    pthread_mutex_init(&ar->heap_lock, NULL);
+    ar->remote = 0;
+    ar->remote_frees = ar->remote_drains = 0;
+#endif
+    if((ar->listp = mem_sbrk_h(ar->heap, (HEAD_WORDS+3)*WSIZE))==(void *)-1){
         return -1;
     }
-    PUT(heap_listp, 0);
-    PUT(heap_listp+(1*WSIZE), 0);
-    PUT(heap_listp+(2*WSIZE), 0);
-    PUT(heap_listp+(3*WSIZE), 0);
-    PUT(heap_listp+(4*WSIZE), 0);
-    PUT(heap_listp+(5*WSIZE), 0);
-    PUT(heap_listp+(6*WSIZE), 0);
-    PUT(heap_listp+(7*WSIZE), 0);
-    PUT(heap_listp+(8*WSIZE), 0);
-    PUT(heap_listp+(9*WSIZE), 0);
-    PUT(heap_listp+(10*WSIZE), 0);                          //why would this block exist?
-    PUT(heap_listp+(11*WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp+(12*WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp+(13*WSIZE), PACK(0, 1));
-
-    block_list_start = heap_listp;
-    heap_listp += (12*WSIZE);
+    /*list heads, bitmap of non-empty lists, slab lists, pagemap and quick lists*/
+    for(i = 0; i < HEAD_WORDS; i++)
+        PUT(ar->listp+(i*WSIZE), 0);
+    PUT(ar->listp+(HEAD_WORDS*WSIZE), PACK(DSIZE, 1));
+    PUT(ar->listp+((HEAD_WORDS+1)*WSIZE), PACK(DSIZE, 1));
+    PUT(ar->listp+((HEAD_WORDS+2)*WSIZE), PACK(0, 1) | PREV_ALLOC);
+
+    ar->lists = ar->listp;
+    ar->listp += ((HEAD_WORDS+1)*WSIZE);
 
     /*explict block's size is aligned to 8 bytes*/
-    if(extend_heap(CHUNKSIZE/DSIZE) == NULL)
+    if((bp = extend_heap(CHUNKSIZE/DSIZE)) == NULL)
         return -1;
+    release(bp, NO_TRIM);
     return 0;
 }
 
+/*
+ * home_arena - the arena the calling thread mallocs from: the next one
+ * round-robin when it first allocates after mm_init, or the one of the
+ * CPU it runs on
+ * */
+static arena_t* home_arena(void)
+{
+    if(narenas == 1)
+        return &arenas[0];
+#ifdef MM_THREADS
+    if(assign == MM_ARENA_CPU) {
+        home = &arenas[(unsigned int)sched_getcpu() % narenas];
+        home_generation = generation;
+        return home;
+    }
+#endif
+    if(home == NULL || home_generation != generation) {
+        home = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % narenas];
+        home_generation = generation;
+    }
+    return home;
+}
+
+/*
+ * arena_of - the arena whose heap holds ptr, or NULL for a mapped block;
+ * the single arena, or else the caller's home (by CPU, the arena of the
+ * CPU of its last malloc), is tried before the rest
+ * */
+static arena_t* arena_of(void* ptr)
+{
+    arena_t* a;
+    int i;
+
+    a = (narenas > 1 && home != NULL && home_generation == generation) ? home : &arenas[0];
+    if((char*)ptr > a->base && (char*)ptr <= a->end)
+        return a;
+    if(narenas == 1)
+        return NULL;
+    for(i = 0; i < narenas; i++)
+        if(&arenas[i] != a && (char*)ptr > arenas[i].base && (char*)ptr <= arenas[i].end)
+            return &arenas[i];
+    return NULL;
+}
+
+/*
+ * find_index - map a block size to its list index
+ * list i holds sizes in (2^(i+2), 2^(i+3)], the last list holds the rest
+ * */
+static int find_index(size_t size)
+{
+    int index;
+
+    if(size <= 8)
+        return 0;
+    index = 32 - __builtin_clz((unsigned int)(size - 1)) - 3;
+    return index < LISTS-1 ? index : LISTS-1;
+}
+
 /*
  * find_list_root - find the exact list according to the block size
  * */
 static char* find_list_root(size_t size)
 {
-    int index = 0;
-    if(size <= 8) index = 0;
-    else if(size <= 16) index = 1;
-    else if(size <= 32) index = 2;
-    else if(size <= 64) index = 3;
-    else if(size <= 128) index = 4;
-    else if(size <= 256) index = 5;
-    else if(size <= 512) index = 6;
-    else if(size <= 1024) index = 7;
-    else if(size <= 2048) index = 8;
-    else index = 9;
-    return block_list_start + index*WSIZE;
+    return ar->lists + find_index(size)*WSIZE;
+}
+
+/*
+ * mm_set_policy - choose the free-list ordering used from the next mm_init
+ * */
+void mm_set_policy(int p)
+{
+    policy = p;
 }
 
 /*
  * insert - insert free block into the list
- * expand from small to big
+ * LIFO pushes at the head, the ordered policies walk to bp's place
  * */
 static void insert(char* bp)
 {
     char* root = find_list_root(GET_SIZE(HDRP(bp)));
-    char* down = GET(root);
+    char* down = GET_PTR(root);
     char* abov = root;
 
-    while(down != NULL) {
-        if(GET_SIZE(HDRP(down)) >= GET_SIZE(HDRP(bp)))
-            break;
-        abov = down;
-        down = GET(DOWN_FREE_BLKP(down));
+    if(root == TREE_ROOT) {
+        tree_insert(bp);
+        PUT_OR(BITMAP, 1u << (LISTS-1));
+        return;
+    }
+    if(cur_policy == MM_POLICY_ADDR) {
+        while(down != NULL && down < bp) {
+            abov = down;
+            down = GET_PTR(DOWN_FREE_BLKP(down));
+        }
+    }
+    else if(cur_policy == MM_POLICY_SIZE) {
+        while(down != NULL && GET_SIZE(HDRP(down)) < GET_SIZE(HDRP(bp))) {
+            abov = down;
+            down = GET_PTR(DOWN_FREE_BLKP(down));
+        }
     }
     if(abov == root) {
-        PUT(DOWN_FREE_BLKP(bp), down);
-        PUT(ABOV_FREE_BLKP(bp), NULL);
+        PUT_PTR(DOWN_FREE_BLKP(bp), down);
+        PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), bp);
-        PUT(root, bp);
+            PUT_PTR(ABOV_FREE_BLKP(down), bp);
+        PUT_PTR(root, bp);
+        PUT_OR(BITMAP, 1u << (root-ar->lists)/WSIZE);
     }
     else {
-        PUT(DOWN_FREE_BLKP(abov), bp);
-        PUT(ABOV_FREE_BLKP(bp), abov);
-        PUT(DOWN_FREE_BLKP(bp), down);
+        PUT_PTR(DOWN_FREE_BLKP(abov), bp);
+        PUT_PTR(ABOV_FREE_BLKP(bp), abov);
+        PUT_PTR(DOWN_FREE_BLKP(bp), down);
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), bp);
+            PUT_PTR(ABOV_FREE_BLKP(down), bp);
     }
 }
 
@@ -164,63 +551,302 @@ static void insert(char* bp)
 static void delete(char* bp)
 {
     char* root = find_list_root(GET_SIZE(HDRP(bp)));
-    char* abov = GET(ABOV_FREE_BLKP(bp));
-    char* down = GET(DOWN_FREE_BLKP(bp));
+    char* abov = GET_PTR(ABOV_FREE_BLKP(bp));
+    char* down = GET_PTR(DOWN_FREE_BLKP(bp));
 
+    if(root == TREE_ROOT) {
+        tree_delete(bp);
+        if(GET_PTR(TREE_ROOT) == NULL)
+            PUT_AND(BITMAP, ~(1u << (LISTS-1)));
+        return;
+    }
     if(abov == NULL) {
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), 0);
-        PUT(root, down);
+            PUT_PTR(ABOV_FREE_BLKP(down), NULL);
+        else
+            PUT_AND(BITMAP, ~(1u << (root-ar->lists)/WSIZE));
+        PUT_PTR(root, down);
     }
     else {
         if(down != NULL)
-            PUT(ABOV_FREE_BLKP(down), abov);
-        PUT(DOWN_FREE_BLKP(abov), down);
+            PUT_PTR(ABOV_FREE_BLKP(down), abov);
+        PUT_PTR(DOWN_FREE_BLKP(abov), down);
     }
 
-    PUT(DOWN_FREE_BLKP(bp), 0);
-    PUT(ABOV_FREE_BLKP(bp), 0);
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
 }
 
 /*
- * coalesce
+ * tree_insert - insert large free block bp into the size trie
+ * walk the size bits from the top until an empty child or a node of
+ * the same size is found
  * */
-static void* coalesce(void* bp)
+static void tree_insert(char* bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int size = GET_SIZE(HDRP(bp));
+    unsigned int key = size;
+    char* t = GET_PTR(TREE_ROOT);
+    char* c;
 
-    if(prev_alloc && next_alloc) {
+    PUT_PTR(CHILD_BLKP(bp, 0), NULL);
+    PUT_PTR(CHILD_BLKP(bp, 1), NULL);
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
+    PUT_PTR(PARENT_BLKP(bp), NULL);
+    if(t == NULL) {
+        PUT_PTR(TREE_ROOT, bp);
+        return;
     }
-    else if(prev_alloc && !next_alloc) {
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        delete(NEXT_BLKP(bp));
-        PUT(HDRP(bp), PACK(size, 0));
-        //PUT(FTRP(bp), PACK(size, 0));               //right?
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+    while(GET_SIZE(HDRP(t)) != size) {
+        c = CHILD_BLKP(t, key >> 31);
+        key <<= 1;
+        if(GET_PTR(c) == NULL) {
+            PUT_PTR(c, bp);
+            PUT_PTR(PARENT_BLKP(bp), t);
+            return;
+        }
+        t = GET_PTR(c);
     }
-    else if(!prev_alloc && next_alloc) {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        delete(PREV_BLKP(bp));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
-        bp = PREV_BLKP(bp);
+    /*same size: put bp on the list behind tree node t*/
+    c = GET_PTR(DOWN_FREE_BLKP(t));
+    PUT_PTR(DOWN_FREE_BLKP(bp), c);
+    PUT_PTR(ABOV_FREE_BLKP(bp), t);
+    if(c != NULL)
+        PUT_PTR(ABOV_FREE_BLKP(c), bp);
+    PUT_PTR(DOWN_FREE_BLKP(t), bp);
+}
+
+/*
+ * tree_delete - remove large free block bp from the size trie
+ * a tree node is replaced by the next block of the same size, or else
+ * by a leaf of its subtree, which keeps every key under its prefix
+ * */
+static void tree_delete(char* bp)
+{
+    char* parent = GET_PTR(PARENT_BLKP(bp));
+    char* abov = GET_PTR(ABOV_FREE_BLKP(bp));
+    char* down = GET_PTR(DOWN_FREE_BLKP(bp));
+    char* r;
+    char* rp;
+    char* c;
+
+    /*a list member is simply unlinked*/
+    if(abov != NULL) {
+        PUT_PTR(DOWN_FREE_BLKP(abov), down);
+        if(down != NULL)
+            PUT_PTR(ABOV_FREE_BLKP(down), abov);
+        return;
     }
+
+    if((r = down) != NULL)
+        PUT_PTR(ABOV_FREE_BLKP(r), NULL);
     else {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        delete(PREV_BLKP(bp));
-        delete(NEXT_BLKP(bp));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);
+        rp = CHILD_BLKP(bp, 1);
+        if((r = GET_PTR(rp)) == NULL)
+            r = GET_PTR(rp = CHILD_BLKP(bp, 0));
+        if(r != NULL) {
+            for(;;) {
+                if((c = GET_PTR(CHILD_BLKP(r, 1))) != NULL)
+                    rp = CHILD_BLKP(r, 1);
+                else if((c = GET_PTR(CHILD_BLKP(r, 0))) != NULL)
+                    rp = CHILD_BLKP(r, 0);
+                else
+                    break;
+                r = c;
+            }
+            PUT_PTR(rp, NULL);
+        }
+    }
+
+    /*hang r where bp was*/
+    if(parent == NULL)
+        PUT_PTR(TREE_ROOT, r);
+    else if(GET_PTR(CHILD_BLKP(parent, 0)) == bp)
+        PUT_PTR(CHILD_BLKP(parent, 0), r);
+    else
+        PUT_PTR(CHILD_BLKP(parent, 1), r);
+    if(r != NULL) {
+        PUT_PTR(PARENT_BLKP(r), parent);
+        c = GET_PTR(CHILD_BLKP(bp, 0));
+        PUT_PTR(CHILD_BLKP(r, 0), c);
+        if(c != NULL)
+            PUT_PTR(PARENT_BLKP(c), r);
+        c = GET_PTR(CHILD_BLKP(bp, 1));
+        PUT_PTR(CHILD_BLKP(r, 1), c);
+        if(c != NULL)
+            PUT_PTR(PARENT_BLKP(c), r);
+    }
+}
+
+/*
+ * tree_find - best fit for size among the large free blocks
+ * follow size's bits down the trie, remembering the deepest right
+ * subtree passed by; every key in it is larger than size, so if the
+ * path gives no exact fit the smallest key there is the next candidate
+ * */
+static char* tree_find(size_t size)
+{
+    unsigned int key = size;
+    char* t = GET_PTR(TREE_ROOT);
+    char* best = NULL;
+    char* rst = NULL;
+    char* rt;
+    size_t rsize = (size_t)-1;
+    size_t tsize;
+
+    while(t != NULL) {
+        tsize = GET_SIZE(HDRP(t));
+        if(tsize >= size && tsize - size < rsize) {
+            best = t;
+            if((rsize = tsize - size) == 0)
+                return best;
+        }
+        rt = GET_PTR(CHILD_BLKP(t, 1));
+        t = GET_PTR(CHILD_BLKP(t, key >> 31));
+        if(rt != NULL && rt != t)
+            rst = rt;
+        key <<= 1;
+    }
+    /*the smallest key of a subtree lies on its leftmost path*/
+    for(t = rst; t != NULL; ) {
+        tsize = GET_SIZE(HDRP(t));
+        if(tsize - size < rsize) {
+            best = t;
+            rsize = tsize - size;
+        }
+        if((rt = GET_PTR(CHILD_BLKP(t, 0))) == NULL)
+            rt = GET_PTR(CHILD_BLKP(t, 1));
+        t = rt;
+    }
+    return best;
+}
+
+/*
+ * set_header - set the size and alloc bit of block bp, keeping the prev
+ * bit, which the owner of the block in front may be flipping
+ * */
+static void set_header(char* bp, unsigned int val)
+{
+#ifdef MM_THREADS
+    unsigned int old = GET(HDRP(bp));
+
+    while(!__atomic_compare_exchange_n((unsigned int *)HDRP(bp), &old,
+                                       val | (old & PREV_ALLOC), 1,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+#else
+    PUT(HDRP(bp), val | GET_PREV_ALLOC(HDRP(bp)));
+#endif
+}
+
+/*
+ * lock_lists, unlock_lists - lock or unlock the free lists in mask,
+ * by ascending index
+ * */
+static void lock_lists(unsigned int mask)
+{
+#ifdef MM_THREADS
+    for(; mask != 0; mask &= mask - 1)
+        LOCK(&ar->list_lock[__builtin_ctz(mask)]);
+#endif
+}
+
+static void unlock_lists(unsigned int mask)
+{
+#ifdef MM_THREADS
+    for(; mask != 0; mask &= mask - 1)
+        UNLOCK(&ar->list_lock[__builtin_ctz(mask)]);
+#endif
+}
+
+/*
+ * release - free the allocated block bp and coalesce it with its free
+ * neighbours. The neighbours are read unlocked, then the lists of their
+ * sizes and of the merged size are locked and the reads checked again.
+ * If keep > 0 and the merged block has keep bytes it is returned still
+ * allocated; keep == 0 trims the heap over it if it ends the heap
+ * */
+static char* release(char* bp, size_t keep)
+{
+    char* next = NEXT_BLKP(bp);
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t psize, nsize;
+    unsigned int hdr, nhdr, mask;
+
+    for(;;) {
+        nhdr = GET(HDRP(next));
+        nsize = (nhdr & 0x1) ? 0 : nhdr & ~0x7;
+        hdr = GET(HDRP(bp));
+        psize = (hdr & PREV_ALLOC) ? 0 : GET_SIZE(bp - DSIZE);
+        mask = 1u << find_index(size + psize + nsize);
+        if(nsize)
+            mask |= 1u << find_index(nsize);
+        if(psize)
+            mask |= 1u << find_index(psize);
+        lock_lists(mask);
+        /*the footer is read before the prev bit: a new owner of the
+          previous block sets the bit before writing over its footer*/
+        if(GET(HDRP(next)) == nhdr &&
+           (psize == 0 ? GET_PREV_ALLOC(HDRP(bp)) != 0 :
+            GET(bp - DSIZE) == psize && GET_PREV_ALLOC(HDRP(bp)) == 0 &&
+            bp - psize > ar->listp && (GET(HDRP(bp - psize)) & ~PREV_ALLOC) == psize))
+            break;
+        unlock_lists(mask);
+    }
+
+    if(nsize) {
+        delete(next);
+        size += nsize;
+    }
+    if(psize) {
+        bp -= psize;
+        delete(bp);
+        size += psize;
     }
+    next = bp + size;
+    if(keep > 0 && size >= keep) {
+        set_header(bp, PACK(size, 1));
+        SET_PREV_ALLOC(next);
+        unlock_lists(mask);
+        return bp;
+    }
+    set_header(bp, PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+    if(keep == 0 && size >= TRIM_THRESHOLD && GET_SIZE(HDRP(next)) == 0 &&
+       trim_heap(bp, size)) {
+        unlock_lists(mask);
+        return NULL;
+    }
+    PUT_PTR(DOWN_FREE_BLKP(bp), NULL);
+    PUT_PTR(ABOV_FREE_BLKP(bp), NULL);
     insert(bp);
+    CLR_PREV_ALLOC(next);
+    unlock_lists(mask);
     return bp;
 }
 
 /*
- * extend_heap
+ * trim_heap - shrink the heap over the free block bp of size bytes if it
+ * still ends the heap; its header becomes the new epilogue
+ * */
+static int trim_heap(char* bp, size_t size)
+{
+    int trimmed = 0;
+
+    LOCK(&ar->heap_lock);
+    if(GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0) {
+        set_header(bp, PACK(0, 1));
+        mem_sbrk_h(ar->heap, -(ssize_t)size);
+        trimmed = 1;
+    }
+    UNLOCK(&ar->heap_lock);
+    return trimmed;
+}
+
+/*
+ * extend_heap - grow the heap by words double words; the new block is
+ * returned allocated, for the caller to release or keep
  * */
 static void* extend_heap(size_t words)
 {
@@ -229,165 +855,1036 @@ static void* extend_heap(size_t words)
 
     /*allocate an even number to maintain alignment*/
     size = (words%2)?(words+1)*DSIZE:words*DSIZE;
-    if((long)(bp = mem_sbrk(size)) ==(void*) -1)
+    LOCK(&ar->heap_lock);
+    if((bp = mem_sbrk_h(ar->heap, size)) == (void*)-1) {
+        UNLOCK(&ar->heap_lock);
         return NULL;
+    }
+
+    /*The new epilogue header, then the block header over the old one*/
+    PUT(bp + size - WSIZE, PACK(0, 1) | PREV_ALLOC);
+    set_header(bp, PACK(size, 1));
+    UNLOCK(&ar->heap_lock);
+    return bp;
+}
 
-    /*Initialize free block header/footer and the epilogue header*/
-    PUT(HDRP(bp), PACK(size, 0));                /*Free block header*/
-    PUT(FTRP(bp), PACK(size, 0));                /*Free block footer*/
-    PUT(DOWN_FREE_BLKP(bp), 0);                  /*Previous free block*/
-    PUT(ABOV_FREE_BLKP(bp), 0);                  /*Next free block*/
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0,1));         /*New epilogue header*/
+/*
+ * grow_heap_end - extend the heap by size bytes if ep, the block behind
+ * one the caller owns, is still the epilogue; the space is left for the
+ * caller to absorb
+ * */
+static int grow_heap_end(char* ep, size_t size)
+{
+    int grown = 0;
 
-    return coalesce(bp);
+    LOCK(&ar->heap_lock);
+    if(GET_SIZE(HDRP(ep)) == 0 && mem_sbrk_h(ar->heap, size) != (void*)-1) {
+        PUT(HDRP(ep + size), PACK(0, 1) | PREV_ALLOC);
+        grown = 1;
+    }
+    UNLOCK(&ar->heap_lock);
+    return grown;
 }
 
 /*
  * find_fit - First Fit strategy
- * - explicit free list
+ * - segregated free lists, empty lists skipped through the bitmap
+ * - with size-ordered lists the first fit is also the best fit
+ * - large blocks come from the size trie, always best fit
+ * the block found is taken off its list under the list's lock
  * */
 static void* find_fit(size_t size)
 {
-    /*First fit search*/
-    char* root = find_list_root(size);
+    unsigned int map = GET(BITMAP) & (~0u << find_index(size));
     char* cur;
+    int i;
 
-    for(root;root != heap_listp-2*WSIZE;root += WSIZE) {
-        cur = (char*)GET(root);
-        while(cur != NULL) {
-            if(GET_SIZE(HDRP(cur)) >= size)
-                return cur;
-            cur = GET(DOWN_FREE_BLKP(cur));
+    while(map != 0) {
+        i = __builtin_ctz(map);
+        LOCK(&ar->list_lock[i]);
+        if(i == LISTS-1)
+            cur = tree_find(size);
+        else {
+            cur = GET_PTR(ar->lists + i*WSIZE);
+            while(cur != NULL && GET_SIZE(HDRP(cur)) < size)
+                cur = GET_PTR(DOWN_FREE_BLKP(cur));
         }
+        if(cur != NULL)
+            take(cur);
+        UNLOCK(&ar->list_lock[i]);
+        if(cur != NULL)
+            return cur;
+        map &= map - 1;
     }
     return NULL;
 }
 
 /*
- * place
+ * take - mark the free block bp allocated, the lock of its list held
+ * */
+static void take(char* bp)
+{
+    delete(bp);
+    set_header(bp, PACK(GET_SIZE(HDRP(bp)), 1));
+    SET_PREV_ALLOC(NEXT_BLKP(bp));
+}
+
+/*
+ * claim - take the block bp behind an owned block if its header still
+ * reads hdr, a free header seen unlocked; returns 0 if it changed
+ * */
+static int claim(char* bp, unsigned int hdr)
+{
+    int ok;
+
+    LOCK(&ar->list_lock[find_index(hdr & ~0x7)]);
+    if((ok = (GET(HDRP(bp)) | PREV_ALLOC) == (hdr | PREV_ALLOC)))
+        take(bp);
+    UNLOCK(&ar->list_lock[find_index(hdr & ~0x7)]);
+    return ok;
+}
+
+/*
+ * place_high - keep size bytes at the top end of the taken block bp,
+ * giving the bottom part back to the free lists
  * */
-static void place(void* bp, size_t size)
+static void* place_high(void* bp, size_t size)
 {
     size_t csize = GET_SIZE(HDRP(bp));
     char* tmp;
 
-    /*block bp must be deleted anyway*/
-    delete(bp);
-    /*6WSIZE = header+footer+down+abov+block*/
-    if((csize-size) >= 6*WSIZE) {
-        PUT(HDRP(bp), PACK(size, 1));
-        PUT(FTRP(bp), PACK(size, 1));
-        tmp = NEXT_BLKP(bp);
-        PUT(HDRP(tmp), PACK(csize-size, 0));
-        PUT(FTRP(tmp), PACK(csize-size, 0));
-        PUT(DOWN_FREE_BLKP(tmp), 0);
-        PUT(ABOV_FREE_BLKP(tmp), 0);
-        coalesce(tmp);
+    if((csize-size) < 2*DSIZE)
+        return bp;
+    tmp = (char*)bp + csize - size;
+    PUT(HDRP(tmp), PACK(size, 1) | PREV_ALLOC);
+    set_header(bp, PACK(csize-size, 1));
+    release(bp, NO_TRIM);
+    return tmp;
+}
+
+/*
+ * split - shrink allocated block bp to size, freeing the tail if it is
+ * big enough to form a block of its own
+ * */
+static void split(void* bp, size_t size)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char* tmp;
+
+    /*2DSIZE = header+down+abov+footer of the free remainder*/
+    if((csize-size) >= 2*DSIZE) {
+        tmp = (char*)bp + size;
+        PUT(HDRP(tmp), PACK(csize-size, 1) | PREV_ALLOC);
+        set_header(bp, PACK(size, 1));
+        release(tmp, NO_TRIM);
     }
-    else {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+}
+
+/*
+ * alloc_block - take a block of asize bytes from the free lists, or from
+ * newly extended heap if nothing fits
+ * */
+static void* alloc_block(size_t asize)
+{
+    char* bp;
+
+    if((bp = find_or_extend(asize)) == NULL)
+        return NULL;
+    split(bp, asize);
+    return bp;
+}
+
+/*
+ * find_or_extend - take a free block of at least asize bytes, merging the
+ * parked quick-list blocks and then growing the heap when nothing fits
+ * */
+static void* find_or_extend(size_t asize)
+{
+    char* bp;
+
+    /*Seach the free list for a fit*/
+    if((bp = find_fit(asize)) != NULL)
+        return bp;
+
+    /*Merge the parked blocks and search again*/
+    if(quick_flush_all() && (bp = find_fit(asize)) != NULL)
+        return bp;
+
+    /*No fit found.Get more memory, merged with a free block ending the heap*/
+    if((bp = extend_heap(MAX(asize, CHUNKSIZE)/DSIZE)) == NULL)
+        return NULL;
+    return release(bp, asize);
+}
+
+/*
+ * alloc_aligned - allocate a block of asize bytes whose payload is
+ * aligned to align; the slack in front is freed again
+ * */
+static void* alloc_aligned(size_t asize, size_t align)
+{
+    char* bp;
+    char* ap;
+    size_t csize;
+
+    if((bp = alloc_block(asize + align + 2*DSIZE)) == NULL)
+        return NULL;
+    ap = (char*)(((size_t)bp + align - 1) & ~(align - 1));
+    if(ap != bp && ap - bp < 2*DSIZE)
+        ap += align;
+    if(ap != bp) {
+        csize = GET_SIZE(HDRP(bp));
+        PUT(HDRP(ap), PACK(csize - (ap - bp), 1) | PREV_ALLOC);
+        set_header(bp, PACK(ap - bp, 1));
+        free_block(bp);
+    }
+    split(ap, asize);
+    return ap;
+}
+
+/*
+ * slab_page - return the slab page holding ptr, or NULL if ptr is an
+ * ordinary block
+ * */
+static char* slab_page(void* ptr)
+{
+    char* page = (char*)((size_t)ptr & ~(SLAB_PAGE-1));
+    size_t idx = PAGE_INDEX(page);
+
+    if(page == (char*)ptr || idx >= GET(PAGEMAP_PAGES))
+        return NULL;
+    if(GET(GET_PTR(PAGEMAP) + idx/32*WSIZE) & 1u << idx%32)
+        return page;
+    return NULL;
+}
+
+/*
+ * slab_mark - set or clear the pagemap bit of slab page page, growing the
+ * pagemap to cover it first. slab_page reads the map unlocked, so a new
+ * map is published before its page count, and with MM_THREADS the old
+ * one is never freed
+ * */
+static int slab_mark(char* page, int slab)
+{
+    size_t idx = PAGE_INDEX(page);
+    size_t pages;
+    char* map;
+    char* newmap;
+
+    LOCK(&ar->pagemap_lock);
+    pages = GET(PAGEMAP_PAGES);
+    map = GET_PTR(PAGEMAP);
+    if(idx >= pages) {
+        pages = MAX(2*pages, (idx/32 + 1)*32);
+        if((newmap = alloc_block(MAX(2*DSIZE, ALIGN(pages/8 + WSIZE)))) == NULL) {
+            UNLOCK(&ar->pagemap_lock);
+            return -1;
+        }
+        memset(newmap, 0, pages/8);
+        if(map != NULL) {
+            memcpy(newmap, map, GET(PAGEMAP_PAGES)/8);
+#ifndef MM_THREADS
+            free_block(map);
+#endif
+        }
+        PUT_PTR(PAGEMAP, newmap);
+        PUT(PAGEMAP_PAGES, pages);
+        map = newmap;
     }
+    map += idx/32*WSIZE;
+    if(slab)
+        PUT(map, GET(map) | 1u << idx%32);
+    else
+        PUT(map, GET(map) & ~(1u << idx%32));
+    UNLOCK(&ar->pagemap_lock);
+    return 0;
 }
 
+/*
+ * slab_push, slab_unlink - add or remove page on its class's list of
+ * pages with free slots
+ * */
+static void slab_push(char* page, int c)
+{
+    char* next = GET_PTR(SLAB_ROOT(c));
+
+    PUT_PTR(SLAB_NEXT(page), next);
+    PUT_PTR(SLAB_PREV(page), NULL);
+    if(next != NULL)
+        PUT_PTR(SLAB_PREV(next), page);
+    PUT_PTR(SLAB_ROOT(c), page);
+}
+
+static void slab_unlink(char* page, int c)
+{
+    char* prev = GET_PTR(SLAB_PREV(page));
+    char* next = GET_PTR(SLAB_NEXT(page));
+
+    if(prev == NULL)
+        PUT_PTR(SLAB_ROOT(c), next);
+    else
+        PUT_PTR(SLAB_NEXT(prev), next);
+    if(next != NULL)
+        PUT_PTR(SLAB_PREV(next), prev);
+}
+
+/*
+ * slab_new - carve a page of class c from the heap and list it
+ * */
+static char* slab_new(int c)
+{
+    char* page;
+    int i, slots;
+
+    if((page = alloc_aligned(SLAB_PAGE, SLAB_PAGE)) == NULL)
+        return NULL;
+    if(slab_mark(page, 1) < 0) {
+        free_block(page);
+        return NULL;
+    }
+    slots = SLAB_SLOTS(c);
+    PUT(SLAB_CLASS(page), c);
+    PUT(SLAB_NFREE(page), slots);
+    for(i = 0; i < SLAB_MAPWORDS; i++, slots -= 32)
+        PUT(SLAB_MAP(page) + i*WSIZE, slots >= 32 ? ~0u : slots > 0 ? (1u << slots) - 1 : 0);
+    slab_push(page, c);
+    return page;
+}
+
+/*
+ * slab_take - take a free slot of class c, carving a new page from the
+ * heap when the class has none; the class lock is held
+ * */
+static void* slab_take(int c)
+{
+    char* page;
+    char* map;
+    unsigned int bits;
+    int i;
+
+    if((page = GET_PTR(SLAB_ROOT(c))) == NULL && (page = slab_new(c)) == NULL)
+        return NULL;
+
+    map = SLAB_MAP(page);
+    while((bits = GET(map)) == 0)
+        map += WSIZE;
+    PUT(map, bits & (bits - 1));
+    PUT(SLAB_NFREE(page), GET(SLAB_NFREE(page)) - 1);
+    if(GET(SLAB_NFREE(page)) == 0)
+        slab_unlink(page, c);
+    i = (map - SLAB_MAP(page))/WSIZE*32 + __builtin_ctz(bits);
+    return page + SLAB_HDR + i*slab_size[c];
+}
+
+/*
+ * slab_alloc - take a free slot of class c
+ * */
+static void* slab_alloc(int c)
+{
+    void* bp;
+
+    LOCK(&ar->slab_lock[c]);
+    bp = slab_take(c);
+    UNLOCK(&ar->slab_lock[c]);
+    return bp;
+}
+
+/*
+ * slab_put - give the slot at ptr back to its page, the class lock held.
+ * Returns 1 if the page emptied and was unlisted, for the caller to free
+ * once the lock is dropped; the last page of a class is kept
+ * */
+static int slab_put(char* page, void* ptr)
+{
+    int c = GET(SLAB_CLASS(page));
+    unsigned int i = ((char*)ptr - page - SLAB_HDR) / slab_size[c];
+    unsigned int nfree = GET(SLAB_NFREE(page)) + 1;
+    char* map = SLAB_MAP(page) + i/32*WSIZE;
+
+    PUT(map, GET(map) | 1u << i%32);
+    PUT(SLAB_NFREE(page), nfree);
+    if(nfree == 1)
+        slab_push(page, c);
+    else if(nfree == SLAB_SLOTS(c) &&
+            (GET_PTR(SLAB_PREV(page)) != NULL || GET_PTR(SLAB_NEXT(page)) != NULL)) {
+        slab_unlink(page, c);
+        slab_mark(page, 0);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * slab_free - give the slot at ptr back to its page; an empty page goes
+ * back to the heap unless it is the last one of its class
+ * */
+static void slab_free(char* page, void* ptr)
+{
+    int empty;
+
+    LOCK(&ar->slab_lock[GET(SLAB_CLASS(page))]);
+    empty = slab_put(page, ptr);
+    UNLOCK(&ar->slab_lock[GET(SLAB_CLASS(page))]);
+    if(empty)
+        free_block(page);
+}
+
+/*
+ * tcache_reset - start the calling thread's cache afresh; blocks cached
+ * under an earlier mm_init went with its heap
+ * */
+static void tcache_reset(tcache_t* tc)
+{
+    memset(tc, 0, sizeof(*tc));
+    tc->generation = generation;
+#ifdef MM_THREADS
+    pthread_once(&tcache_once, tcache_key_create);
+    pthread_setspecific(tcache_key, tc);
+#endif
+}
+
+/*
+ * tcache_count - add the thread's hit and miss counts to the totals
+ * */
+static void tcache_count(tcache_t* tc)
+{
+    __atomic_fetch_add(&tcache_hits, tc->hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tcache_misses, tc->misses, __ATOMIC_RELAXED);
+    tc->hits = tc->misses = 0;
+}
+
+/*
+ * tcache_alloc - serve a slot of class c from the thread cache, refilling
+ * it with half its capacity under one lock of the home arena on a miss
+ * */
+static void* tcache_alloc(int c)
+{
+    tcache_t* tc = &tcache;
+    char* bp;
+    int n;
+
+    if(tc->generation != generation)
+        tcache_reset(tc);
+    if((bp = tc->head[c]) == NULL) {
+        tc->misses++;
+        tcache_count(tc);
+        LOCK(&ar->slab_lock[c]);
+        for(n = (tcache_cap + 1)/2; n > 0 && (bp = slab_take(c)) != NULL; n--) {
+            *(char**)bp = tc->head[c];
+            tc->head[c] = bp;
+            tc->count[c]++;
+        }
+        UNLOCK(&ar->slab_lock[c]);
+        if((bp = tc->head[c]) == NULL)
+            return NULL;
+    }
+    else
+        tc->hits++;
+    tc->head[c] = *(char**)bp;
+    tc->count[c]--;
+    return bp;
+}
+
+/*
+ * tcache_flush - give n slots of class c back to their pages, taking
+ * the class lock of an arena once for each run of its slots
+ * */
+static void tcache_flush(tcache_t* tc, int c, int n)
+{
+    char* bp;
+    char* page;
+    char* empty;
+
+    while(n > 0 && tc->head[c] != NULL) {
+        ar = arena_of(tc->head[c]);
+        empty = NULL;
+        LOCK(&ar->slab_lock[c]);
+        while(n > 0 && (bp = tc->head[c]) != NULL && arena_of(bp) == ar) {
+            tc->head[c] = *(char**)bp;
+            tc->count[c]--;
+            n--;
+            page = slab_page(bp);
+            if(slab_put(page, bp)) {
+                *(char**)page = empty;
+                empty = page;
+            }
+        }
+        UNLOCK(&ar->slab_lock[c]);
+        for(; empty != NULL; empty = page) {
+            page = *(char**)empty;
+            free_block(empty);
+        }
+    }
+}
+
+/*
+ * tcache_free - cache the slot at ptr of page for the calling thread,
+ * flushing half the cache of its class first when it is full
+ * */
+static void tcache_free(char* page, void* ptr)
+{
+    tcache_t* tc = &tcache;
+    int c = GET(SLAB_CLASS(page));
+
+    if(tc->generation != generation)
+        tcache_reset(tc);
+    if(tcache_cap == 0) {
+        slab_free(page, ptr);
+        return;
+    }
+    if(tc->count[c] >= tcache_cap) {
+        tcache_flush(tc, c, (tcache_cap + 1)/2);
+        tcache_count(tc);
+    }
+    *(char**)ptr = tc->head[c];
+    tc->head[c] = ptr;
+    tc->count[c]++;
+}
+
+#ifdef MM_THREADS
+/*
+ * tcache_exit - flush the cache of an exiting thread
+ * */
+static void tcache_exit(void* arg)
+{
+    tcache_t* tc = (tcache_t*)arg;
+    int c;
+
+    if(tc->generation != generation)
+        return;
+    GLOBAL_LOCK();
+    /*nobody mallocs from a round-robin home after its thread is gone*/
+    if(assign == MM_ARENA_THREAD && home_generation == generation)
+        remote_drain(home);
+    for(c = 0; c < SLAB_CLASSES; c++)
+        tcache_flush(tc, c, tc->count[c]);
+    GLOBAL_UNLOCK();
+    tcache_count(tc);
+}
+
+static void tcache_key_create(void)
+{
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/*
+ * remote_arena - whether the calling thread frees into arena a from
+ * outside: a is not its home, or not the arena of its CPU. A thread that
+ * has not malloced since mm_init is outside every arena
+ * */
+static int remote_arena(arena_t* a)
+{
+    if(narenas == 1 || !remote_on)
+        return 0;
+    if(assign == MM_ARENA_CPU)
+        return a != &arenas[(unsigned int)sched_getcpu() % narenas];
+    return home_generation != generation || a != home;
+}
+
+/*
+ * remote_free - push bp on the remote list of arena a with a single CAS,
+ * leaving it allocated; the free that fills the list to REMOTE_MAX
+ * drains it, so an arena nobody mallocs from does not hoard blocks
+ * */
+static void remote_free(arena_t* a, char* bp)
+{
+    unsigned long long old, new;
+
+    old = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+    do {
+        *(unsigned long long*)bp = old;
+        new = (REMOTE_COUNT(old) + 1) << 32 | (unsigned long long)((bp - a->base) / DSIZE);
+    } while(!__atomic_compare_exchange_n(&a->remote, &old, new, 1,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if(REMOTE_COUNT(new) >= REMOTE_MAX)
+        remote_drain(a);
+}
+
+/*
+ * remote_drain - take the whole remote list of arena a with one exchange
+ * and free its blocks; slab slots go to the thread cache when the caller
+ * mallocs from a, straight to their pages otherwise. Leaves ar at a
+ * */
+static void remote_drain(arena_t* a)
+{
+    unsigned long long list;
+    int cache = !remote_arena(a);
+    char* bp;
+
+    if((list = __atomic_exchange_n(&a->remote, 0, __ATOMIC_ACQUIRE)) == 0)
+        return;
+    __atomic_fetch_add(&a->remote_frees, REMOTE_COUNT(list), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&a->remote_drains, 1, __ATOMIC_RELAXED);
+    while(list != 0) {
+        bp = a->base + REMOTE_TOP(list) * DSIZE;
+        list = *(unsigned long long*)bp;
+        ar = a;
+        free_local(bp, cache);
+    }
+    ar = a;
+}
+#endif
+
 /*
  * mm_malloc - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
  */
 void *mm_malloc(size_t size)
+{
+    void* bp;
+
+    GLOBAL_LOCK();
+    bp = allocate(size);
+    GLOBAL_UNLOCK();
+    return bp;
+}
+
+/*
+ * allocate - mm_malloc without the global lock
+ * */
+static void* allocate(size_t size)
 {
     size_t asize;                               /*Ajusted block size*/
-    size_t extendsize;                          /*Amount to extend heap if no fit*/
     char* bp;
 
     /*Ignore spurious request*/
     if(size == 0)
         return NULL;
+    ar = home_arena();
+#ifdef MM_THREADS
+    /*Blocks other threads freed into the arena come back first*/
+    if(__atomic_load_n(&ar->remote, __ATOMIC_RELAXED) != 0)
+        remote_drain(ar);
+#endif
 
-    /*Ajust block size to include overhead and alignment reqs*/
-    if(size <= DSIZE)
-        asize = 2*DSIZE;
-    else
-        asize = DSIZE*((size + DSIZE + (DSIZE-1))/DSIZE);
+    /*Small requests go to the slab pages, through the thread cache*/
+    if(size <= SLAB_MAX) {
+        if(tcache_cap == 0)
+            return slab_alloc(slab_class[(size + DSIZE-1)/DSIZE]);
+        return tcache_alloc(slab_class[(size + DSIZE-1)/DSIZE]);
+    }
 
-    /*Seach the free list for a fit*/
-    if((bp = find_fit(asize)) != NULL) {
-        place(bp,asize);
+    /*Ajust block size to include the header and alignment reqs*/
+    asize = MAX(2*DSIZE, ALIGN(size + WSIZE));
+
+    /*Huge requests are mapped on their own*/
+    if(asize >= MMAP_THRESHOLD)
+        return map_block(asize);
+
+    /*Reuse a parked block of the same size*/
+    if(asize >= QUICK_MIN && asize <= QUICK_MAX && (bp = quick_pop(asize)) != NULL)
         return bp;
-    }
+    return alloc_block(asize);
+}
 
-    /*No fit found.Get more memory and place the block*/
-    extendsize = MAX(asize, CHUNKSIZE);
-    if((bp = extend_heap(extendsize/DSIZE)) == NULL)
-        return NULL;
-    place(bp,asize);
-    return bp;
+/*
+ * free_block - return an ordinary block to the free lists
+ * */
+static void free_block(void* bp)
+{
+    release(bp, 0);
 }
 
 /*
  * mm_free - Freeing a block
  */
 void mm_free(void *bp)
+{
+    GLOBAL_LOCK();
+    deallocate(bp);
+    GLOBAL_UNLOCK();
+}
+
+/*
+ * deallocate - mm_free without the global lock
+ * */
+static void deallocate(void* bp)
 {
     if(bp == 0)
         return;
-    size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-    PUT(DOWN_FREE_BLKP(bp), 0);
-    PUT(ABOV_FREE_BLKP(bp), 0);
-    coalesce(bp);
+    if((ar = arena_of(bp)) == NULL) {
+        mem_unmap((char*)bp - DSIZE);
+        return;
+    }
+#ifdef MM_THREADS
+    if(remote_arena(ar)) {
+        remote_free(ar, bp);
+        return;
+    }
+#endif
+    free_local(bp, 1);
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * free_local - free bp into its arena ar, slab slots through the thread
+ * cache if cache is set
+ * */
+static void free_local(char* bp, int cache)
+{
+    char* page;
+    size_t size;
+
+    if((page = slab_page(bp)) != NULL) {
+        if(cache)
+            tcache_free(page, bp);
+        else
+            slab_free(page, bp);
+        return;
+    }
+    size = GET_SIZE(HDRP(bp));
+    if(size >= QUICK_MIN && size <= QUICK_MAX)
+        quick_push(bp, size);
+    else
+        free_block(bp);
+}
+
+/*
+ * quick_push - park the allocated block bp on the quick list of its size;
+ * a full list is detached and merged once the lock is dropped
+ * */
+static void quick_push(char* bp, size_t size)
+{
+    char* root = QUICK_ROOT(size);
+    char* head;
+    char* full = NULL;
+    unsigned int n;
+
+    LOCK(&ar->list_lock[find_index(size)]);
+    head = GET_PTR(root);
+    n = head ? GET(QUICK_COUNT(head)) + 1 : 1;
+    if(n > QUICK_LIMIT) {
+        full = head;
+        head = NULL;
+        n = 1;
+    }
+    PUT_PTR(QUICK_NEXT(bp), head);
+    PUT(QUICK_COUNT(bp), n);
+    PUT_PTR(root, bp);
+    UNLOCK(&ar->list_lock[find_index(size)]);
+    PUT_ADD(QUICK_PARKED, 1);
+    quick_release(full);
+}
+
+/*
+ * quick_pop - take the most recently parked block of the given size
+ * */
+static void* quick_pop(size_t size)
+{
+    int i = find_index(size);
+    char* root = QUICK_ROOT(size);
+    char* bp;
+
+    LOCK(&ar->list_lock[i]);
+    if((bp = GET_PTR(root)) != NULL) {
+        PUT(root, GET(QUICK_NEXT(bp)));
+        ar->quick_hits[i]++;
+    }
+    else
+        ar->quick_misses[i]++;
+    UNLOCK(&ar->list_lock[i]);
+    if(bp != NULL)
+        PUT_ADD(QUICK_PARKED, -1);
+    return bp;
+}
+
+/*
+ * quick_release - free and coalesce a detached chain of parked blocks
+ * */
+static void quick_release(char* bp)
+{
+    char* next;
+
+    for(; bp != NULL; bp = next) {
+        next = GET_PTR(QUICK_NEXT(bp));
+        PUT_ADD(QUICK_PARKED, -1);
+        free_block(bp);
+    }
+}
+
+/*
+ * quick_flush - free and coalesce every block parked on one quick list
+ * */
+static void quick_flush(size_t size)
+{
+    char* root = QUICK_ROOT(size);
+    char* bp;
+
+    LOCK(&ar->list_lock[find_index(size)]);
+    bp = GET_PTR(root);
+    PUT(root, 0);
+    UNLOCK(&ar->list_lock[find_index(size)]);
+    quick_release(bp);
+}
+
+/*
+ * quick_flush_all - flush every quick list; returns 0 if none was parked
+ * */
+static int quick_flush_all(void)
+{
+    size_t size;
+
+    if(GET(QUICK_PARKED) == 0)
+        return 0;
+    for(size = QUICK_MIN; size <= QUICK_MAX; size += DSIZE)
+        quick_flush(size);
+    return 1;
+}
+
+/*
+ * map_block - map a region for a block of asize bytes
+ * */
+static void* map_block(size_t asize)
+{
+    size_t size = (asize + WSIZE + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    char* bp;
+
+    /*The region size has to fit the header*/
+    if(size != (unsigned int)size)
+        return NULL;
+    if((bp = mem_map(size)) == NULL)
+        return NULL;
+    bp += DSIZE;
+    PUT(HDRP(bp), PACK(size, 1) | MAPPED);
+    return bp;
+}
+
+/*
+ * map_realloc - resize the mapped block ptr; it is remapped while it
+ * stays above MMAP_THRESHOLD and moves into the heap below it
+ * */
+static void* map_realloc(void* ptr, size_t size)
+{
+    size_t asize = MAX(2*DSIZE, ALIGN(size + WSIZE));
+    size_t csize = GET_SIZE(HDRP(ptr));
+    size_t rsize = (asize + WSIZE + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    char* newptr;
+
+    if(asize < MMAP_THRESHOLD) {
+        if((newptr = allocate(size)) == NULL)
+            return NULL;
+        memcpy(newptr, ptr, size);
+        mem_unmap((char*)ptr - DSIZE);
+        return newptr;
+    }
+    if(rsize == csize)
+        return ptr;
+    if(rsize != (unsigned int)rsize ||
+       (newptr = mem_remap((char*)ptr - DSIZE, rsize)) == NULL)
+        return NULL;
+    newptr += DSIZE;
+    PUT(HDRP(newptr), PACK(rsize, 1) | MAPPED);
+    return newptr;
+}
+
+/*
+ * mm_get_stats - report the thread-cache counters of all threads, those
+ * of exiting threads included, and the quick-list and remote-free
+ * counters of all arenas
+ * */
+void mm_get_stats(mm_stats_t* stats)
+{
+    int i, j;
+
+    stats->tcache_hits = tcache_hits;
+    stats->tcache_misses = tcache_misses;
+    if(tcache.generation == generation) {
+        stats->tcache_hits += tcache.hits;
+        stats->tcache_misses += tcache.misses;
+    }
+    stats->quick_hits = stats->quick_misses = 0;
+    stats->remote_frees = stats->remote_drains = 0;
+    for(j = 0; j < narenas; j++) {
+        for(i = 0; i < LISTS; i++) {
+            stats->quick_hits += arenas[j].quick_hits[i];
+            stats->quick_misses += arenas[j].quick_misses[i];
+        }
+#ifdef MM_THREADS
+        stats->remote_frees += arenas[j].remote_frees;
+        stats->remote_drains += arenas[j].remote_drains;
+#endif
+    }
+}
+
+/*
+ * mm_set_tcache - set the thread cache capacity per slab class from the
+ * next mm_init and return the one set before; 0 turns the cache off
+ * */
+int mm_set_tcache(int capacity)
+{
+    int old = want_tcache_cap;
+
+    want_tcache_cap = capacity < 0 ? 0 : capacity;
+    return old;
+}
+
+#ifdef MM_THREADS
+/*
+ * mm_set_locking - choose the per-list locks or the single global lock;
+ * only while no other thread is in the allocator
+ * */
+void mm_set_locking(int mode)
+{
+    locking = mode;
+}
+
+/*
+ * mm_set_arenas - split the heap in n arenas from the next mm_init, up
+ * to MM_ARENAS, and pick how threads are spread over them
+ * */
+void mm_set_arenas(int n, int how)
+{
+    want_arenas = n < 1 ? 1 : n > MM_ARENAS ? MM_ARENAS : n;
+    assign = how;
+}
+
+/*
+ * mm_set_remote - from the next mm_init, free blocks of another thread's
+ * arena through its remote list, or straight into the arena
+ * */
+void mm_set_remote(int on)
+{
+    want_remote = on;
+}
+#endif
+
+/*
+ * mm_realloc - resize in place when possible
+ *     shrink: split off the tail
+ *     grow:   absorb a free next block, extending the heap first when
+ *             the block (or its free successor) ends the heap
+ *     otherwise fall back to malloc, copy and free
+ *     mapped blocks are remapped, see map_realloc
  */
 void *mm_realloc(void *ptr, size_t size)
 {
-    /*
-    void *oldptr = ptr;
-    void *newptr;
-    size_t copySize;
-
-    newptr = mm_malloc(size);
-    if (newptr == NULL)
-      return NULL;
+    void* newptr;
 
-    copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
-    if (size < copySize)
-      copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
+    GLOBAL_LOCK();
+    newptr = reallocate(ptr, size);
+    GLOBAL_UNLOCK();
     return newptr;
-    */
+}
 
-    //ptr is a block pointer
+/*
+ * reallocate - mm_realloc without the global lock
+ * */
+static void* reallocate(void* ptr, size_t size)
+{
     void* newptr;
+    char* next;
+    char* page;
+    size_t asize;
     size_t csize;
-    size_t newsize;
+    size_t nsize;
+    size_t need;
+    unsigned int nhdr;
 
     //if ptr = NULL,it's equivalent to mm_malloc(size)
-    if(ptr == NULL) {
-        newptr = mm_malloc(size);
-        if(!newptr) {
-            return NULL;
-        }
-        return newptr;
-    }
+    if(ptr == NULL)
+        return allocate(size);
 
     //if size = 0,it's equivalent to mm_free(ptr)
     if(size == 0) {
-        mm_free(ptr);
+        deallocate(ptr);
         return NULL;
     }
 
-    //normal realloc
+    /*Resize in the arena of ptr; mapped blocks are in none*/
+    if((ar = arena_of(ptr)) == NULL)
+        return map_realloc(ptr, size);
+
+    /*A slab slot keeps its place while the request still fits*/
+    if((page = slab_page(ptr)) != NULL) {
+        csize = slab_size[GET(SLAB_CLASS(page))];
+        if(size <= csize)
+            return ptr;
+        if((newptr = allocate(size)) == NULL)
+            return NULL;
+        memcpy(newptr, ptr, csize);
+        deallocate(ptr);
+        return newptr;
+    }
+
+    asize = MAX(2*DSIZE, ALIGN(size + WSIZE));
     csize = GET_SIZE(HDRP(ptr));
-    newsize = ALIGN(size) + DSIZE;
-    newptr = ptr;
-    PUT(HDRP(newptr), PACK(newsize, 1));
-    PUT(HDRP(newptr), PACK(newsize, 1));
+
+    /*Shrink in place*/
+    if(asize <= csize) {
+        split(ptr, asize);
+        return ptr;
+    }
+
+    /*Take the free next block if it helps, as read unlocked*/
+    next = NEXT_BLKP(ptr);
+    nhdr = GET(HDRP(next));
+    nsize = 0;
+    if((nhdr & 0x1) == 0 &&
+       (csize + (nhdr & ~0x7) >= asize || GET_SIZE(HDRP(next + (nhdr & ~0x7))) == 0) &&
+       claim(next, nhdr))
+        nsize = nhdr & ~0x7;
+
+    /*At the heap end, extend by just the shortfall, rounded to keep the
+      alignment, and absorb the new space too*/
+    need = 0;
+    if(csize + nsize < asize && GET_SIZE(HDRP(next + nsize)) == 0) {
+        need = (asize - csize - nsize + DSIZE) & ~(2*DSIZE - 1);
+        if(!grow_heap_end(next + nsize, need))
+            need = 0;
+    }
+
+    /*Grow in place*/
+    if(csize + nsize + need >= asize) {
+        set_header(ptr, PACK(csize + nsize + need, 1));
+        split(ptr, asize);
+        return ptr;
+    }
+    if(nsize != 0)
+        free_block(next);
+
+    /*Fall back to malloc, copy and free. The copy is carved from the top
+      of the free block: a block that grew once is likely to grow again, and
+      at the heap end it can then do so in place*/
+    if(asize >= MMAP_THRESHOLD)
+        newptr = map_block(asize);
+    else if((newptr = find_or_extend(asize)) != NULL)
+        newptr = place_high(newptr, asize);
+    if(newptr == NULL)
+        return NULL;
+    memcpy(newptr, ptr, csize - WSIZE);
+    free_block(ptr);
     return newptr;
+}
+
+/*
+ * mm_calloc - allocate nmemb elements of size bytes, zeroed; NULL if the
+ * total overflows
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void* bp;
 
+    if(size != 0 && nmemb > (size_t)-1 / size)
+        return NULL;
+    if((bp = mm_malloc(nmemb * size)) != NULL)
+        memset(bp, 0, nmemb * size);
+    return bp;
 }
 
+/*
+ * mm_memalign - allocate size bytes at a multiple of alignment, a power
+ * of two; mm_malloc already aligns to ALIGNMENT. Larger alignments come
+ * from the free lists, even for sizes that would be mapped
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    void* bp;
+
+    if(alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if(size == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    GLOBAL_LOCK();
+    ar = home_arena();
+    bp = alloc_aligned(MAX(2*DSIZE, ALIGN(size + WSIZE)), alignment);
+    GLOBAL_UNLOCK();
+    return bp;
+}
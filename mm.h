@@ -5,6 +5,77 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Zeroed and over-aligned blocks, for the c and m records of version 2
+ * traces. Allocators without them leave them undefined; mdriver then
+ * zeroes an mm_malloc block itself and can only serve alignments up
+ * to ALIGNMENT.
+ */
+extern void *mm_calloc(size_t nmemb, size_t size) __attribute__((weak));
+extern void *mm_memalign(size_t alignment, size_t size) __attribute__((weak));
+
+/*
+ * Free-list ordering policies. mm.c compiles in POLICY as the default;
+ * mm_set_policy switches it from the next mm_init. Allocators without
+ * policies leave it undefined, hence the weak reference.
+ */
+#define MM_POLICY_LIFO 0    /* push at the list head, first fit */
+#define MM_POLICY_ADDR 1    /* address ordered, first fit */
+#define MM_POLICY_SIZE 2    /* size ordered, best fit */
+#define MM_POLICIES    3
+
+extern void mm_set_policy(int policy) __attribute__((weak));
+
+/*
+ * Allocator counters since the last mm_init, printed by mdriver when the
+ * allocator provides mm_get_stats.
+ */
+typedef struct {
+    unsigned long quick_hits;   /* mallocs served from a quick list */
+    unsigned long quick_misses; /* quick-list sized mallocs that missed */
+    unsigned long tcache_hits;  /* small mallocs served by a thread cache */
+    unsigned long tcache_misses;/* small mallocs that refilled one */
+    unsigned long remote_frees; /* frees passed to the thread of the arena */
+    unsigned long remote_drains;/* batches that thread took them back in */
+} mm_stats_t;
+
+extern void mm_get_stats(mm_stats_t *stats) __attribute__((weak));
+
+/*
+ * Capacity per size class of the thread caches in front of the small
+ * size classes, from the next mm_init; 0 turns them off. Returns the
+ * capacity set before.
+ */
+extern int mm_set_tcache(int capacity) __attribute__((weak));
+
+/*
+ * Locking of an allocator built with MM_THREADS: a lock per free list
+ * and slab class, or one lock around every call. Single-threaded
+ * builds leave mm_set_locking undefined.
+ */
+#define MM_LOCK_CLASS  0    /* per-class locks plus a heap-growth lock */
+#define MM_LOCK_GLOBAL 1    /* one global lock */
+
+extern void mm_set_locking(int mode) __attribute__((weak));
+
+/*
+ * Arenas of an allocator built with MM_THREADS: from the next mm_init
+ * the heap is split in arenas with their own lists, locks and memlib
+ * heap, and each thread mallocs from one of them.
+ */
+#define MM_ARENA_THREAD 0   /* round-robin as threads first allocate */
+#define MM_ARENA_CPU    1   /* by the CPU the malloc runs on */
+
+extern void mm_set_arenas(int arenas, int assign) __attribute__((weak));
+
+/*
+ * With arenas, a thread freeing a block of an arena it does not malloc
+ * from pushes it on a lock-free list of that arena, which is emptied
+ * in batches by the next malloc from it. mm_set_remote(0) frees such
+ * blocks into the arena directly, from the next mm_init.
+ */
+extern void mm_set_remote(int on) __attribute__((weak));
+
 
 /*
  * Students work in teams of one or two.  Teams enter their team name,